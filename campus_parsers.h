@@ -0,0 +1,101 @@
+// Command-line list parsers
+//
+// Parsers of the id lists and failure schedules given on the command line,
+// shared by the campus simulation and its unit checks (campus_unit_checks.cc).
+// Malformed specifications abort with a message naming the bad entry.
+
+#ifndef CAMPUS_PARSERS_H
+#define CAMPUS_PARSERS_H
+
+#include "ns3/abort.h"
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// A link or switch outage: down at `down` seconds, back up at `up`
+struct FailureEvent {
+    bool node;                  // id is a switch whose links all fail, else a topology link
+    uint32_t id;
+    double down;
+    double up;
+};
+
+// Non-empty fields of text between separators
+inline std::vector<std::string> SplitString(const std::string& text, char separator) {
+    std::vector<std::string> parts;
+    std::string::size_type begin = 0;
+    while (begin <= text.size()) {
+        std::string::size_type end = text.find(separator, begin);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+        if (end > begin) {
+            parts.push_back(text.substr(begin, end - begin));
+        }
+        begin = end + 1;
+    }
+    return parts;
+}
+
+// A whole number of 32 bits; what names the value in the abort message
+inline uint32_t ParseUnsigned(const std::string& text, const std::string& what) {
+    char *end = 0;
+    errno = 0;
+    unsigned long value = 0;
+    if (!text.empty() && std::isdigit((unsigned char)text[0])) {
+        value = std::strtoul(text.c_str(), &end, 10);
+    }
+    NS_ABORT_MSG_IF(!end || *end != '\0' || errno == ERANGE || value > UINT32_MAX,
+                    what << " '" << text << "' is not a whole number");
+    return value;
+}
+
+// A finite decimal number; what names the value in the abort message
+inline double ParseNumber(const std::string& text, const std::string& what) {
+    char *end = 0;
+    double value = text.empty() ? 0.0 : std::strtod(text.c_str(), &end);
+    NS_ABORT_MSG_IF(!end || end == text.c_str() || *end != '\0' || !std::isfinite(value),
+                    what << " '" << text << "' is not a number");
+    return value;
+}
+
+// Expands "1-10,22" into the listed ids
+inline std::vector<uint32_t> ParseIdList(const std::string& text) {
+    std::vector<uint32_t> ids;
+    std::vector<std::string> ranges = SplitString(text, ',');
+    for (size_t r = 0; r < ranges.size(); ++r) {
+        std::string::size_type dash = ranges[r].find('-');
+        uint32_t first = ParseUnsigned(ranges[r].substr(0, dash), "Id");
+        uint32_t last = dash == std::string::npos ? first : ParseUnsigned(ranges[r].substr(dash + 1), "Id");
+        for (uint32_t id = first; id <= last; ++id) {
+            ids.push_back(id);
+        }
+    }
+    return ids;
+}
+
+// Parses "link:3@4-6;node:7@5-8": link 3 down from 4 s to 6 s, switch 7 from 5 s to 8 s
+inline std::vector<FailureEvent> ParseFailures(const std::string& text) {
+    std::vector<FailureEvent> events;
+    std::vector<std::string> specs = SplitString(text, ';');
+    for (size_t i = 0; i < specs.size(); ++i) {
+        std::string::size_type colon = specs[i].find(':');
+        std::string::size_type at = specs[i].find('@');
+        std::string::size_type dash = specs[i].find('-', at);
+        NS_ABORT_MSG_IF(colon == std::string::npos || at == std::string::npos || dash == std::string::npos,
+                        "Failure '" << specs[i] << "' is not link:<id>@<down>-<up> or node:<id>@<down>-<up>");
+        std::string kind = specs[i].substr(0, colon);
+        NS_ABORT_MSG_IF(kind != "link" && kind != "node", "Unknown failure kind " << kind);
+        FailureEvent event = { kind == "node", ParseUnsigned(specs[i].substr(colon + 1, at - colon - 1), "Failure id"),
+                               ParseNumber(specs[i].substr(at + 1, dash - at - 1), "Failure time"),
+                               ParseNumber(specs[i].substr(dash + 1), "Failure time") };
+        events.push_back(event);
+    }
+    return events;
+}
+
+#endif /* CAMPUS_PARSERS_H */
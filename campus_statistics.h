@@ -0,0 +1,255 @@
+// Streaming delay statistics and steady-state estimators
+//
+// Pure accumulators and estimators shared by the campus simulation and its unit
+// checks (campus_unit_checks.cc). Nothing here touches the simulator beyond
+// reading a Time.
+
+#ifndef CAMPUS_STATISTICS_H
+#define CAMPUS_STATISTICS_H
+
+#include "ns3/nstime.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+// Log-bucketed latency histogram: 16 linear sub-buckets per power of two of
+// nanoseconds, 1 us to ~137 s, so quantiles are within ~3% of the true value.
+class LatencyHistogram {
+public:
+    static const uint32_t kSubBucketBits = 4;
+    static const uint32_t kMinExponent = 10;
+    static const uint32_t kMaxExponent = 37;
+    static const uint32_t kBuckets = (kMaxExponent - kMinExponent + 1) << kSubBucketBits;
+
+    LatencyHistogram() : m_total(0) { std::fill(m_counts, m_counts + kBuckets, 0u); }
+
+    void Add(int64_t nanoseconds) {
+        m_counts[BucketOf(nanoseconds)]++;
+        m_total++;
+    }
+
+    void Merge(const LatencyHistogram& other) {
+        for (uint32_t b = 0; b < kBuckets; ++b) {
+            m_counts[b] += other.m_counts[b];
+        }
+        m_total += other.m_total;
+    }
+
+    uint64_t GetCount(void) const { return m_total; }
+
+    // Explicit field order for exchange between ranks: total, then the bucket counts
+    static const uint32_t kPackedWords = 1 + kBuckets;
+    void Pack(uint64_t *words) const {
+        words[0] = m_total;
+        std::copy(m_counts, m_counts + kBuckets, words + 1);
+    }
+    void Unpack(const uint64_t *words) {
+        m_total = words[0];
+        for (uint32_t b = 0; b < kBuckets; ++b) {
+            m_counts[b] = (uint32_t)words[1 + b];
+        }
+    }
+
+    // Midpoint of the bucket holding quantile q, in seconds
+    double Quantile(double q) const {
+        if (m_total == 0) {
+            return 0.0;
+        }
+        uint64_t rank = (uint64_t)std::ceil(q * m_total);
+        uint64_t seen = 0;
+        for (uint32_t b = 0; b < kBuckets; ++b) {
+            seen += m_counts[b];
+            if (seen >= std::max<uint64_t>(rank, 1)) {
+                return (BucketLow(b) + BucketLow(b + 1)) / 2.0 * 1e-9;
+            }
+        }
+        return BucketLow(kBuckets) * 1e-9;
+    }
+
+private:
+    static uint32_t BucketOf(int64_t nanoseconds) {
+        if (nanoseconds < (int64_t(1) << kMinExponent)) {
+            return 0;
+        }
+        uint32_t exponent = 63 - __builtin_clzll((uint64_t)nanoseconds);
+        if (exponent > kMaxExponent) {
+            return kBuckets - 1;
+        }
+        uint32_t sub = (nanoseconds >> (exponent - kSubBucketBits)) & ((1u << kSubBucketBits) - 1);
+        return ((exponent - kMinExponent) << kSubBucketBits) | sub;
+    }
+
+    static double BucketLow(uint32_t bucket) {
+        uint32_t exponent = kMinExponent + (bucket >> kSubBucketBits);
+        uint32_t sub = bucket & ((1u << kSubBucketBits) - 1);
+        return std::ldexp(1.0 + sub / double(1u << kSubBucketBits), exponent);
+    }
+
+    uint32_t m_counts[kBuckets];
+    uint64_t m_total;
+};
+
+// Welford mean/variance, RFC 3550 interarrival jitter and a latency histogram
+class StreamingDelayStats {
+public:
+    StreamingDelayStats() : m_count(0), m_mean(0.0), m_m2(0.0), m_jitter(0.0), m_lastDelay(0.0), m_bytes(0) {}
+
+    void Add(ns3::Time delay, uint32_t bytes) {
+        double d = delay.GetSeconds();
+        m_count++;
+        double delta = d - m_mean;
+        m_mean += delta / m_count;
+        m_m2 += delta * (d - m_mean);
+        // J(i) = J(i-1) + (|D(i-1,i)| - J(i-1)) / 16, with D the change in transit time
+        if (m_count > 1) {
+            m_jitter += (std::fabs(d - m_lastDelay) - m_jitter) / 16.0;
+        }
+        m_lastDelay = d;
+        m_bytes += bytes;
+        m_histogram.Add(delay.GetNanoSeconds());
+    }
+
+    // Folds another accumulator in; jitter is per-flow and is not merged
+    void Merge(const StreamingDelayStats& other) {
+        if (other.m_count == 0) {
+            return;
+        }
+        uint64_t count = m_count + other.m_count;
+        double delta = other.m_mean - m_mean;
+        m_mean += delta * other.m_count / count;
+        m_m2 += other.m_m2 + delta * delta * m_count * other.m_count / count;
+        m_count = count;
+        m_bytes += other.m_bytes;
+        m_histogram.Merge(other.m_histogram);
+    }
+
+    uint64_t GetCount(void) const { return m_count; }
+    uint64_t GetBytes(void) const { return m_bytes; }
+    double GetMean(void) const { return m_mean; }
+    double GetVariance(void) const { return m_count > 1 ? m_m2 / (m_count - 1) : 0.0; }
+    double GetJitter(void) const { return m_jitter; }
+    double GetQuantile(double q) const { return m_histogram.Quantile(q); }
+
+    // Field by field, so ranks exchange values rather than object bytes
+    static const uint32_t kPackedReals = 4;
+    static const uint32_t kPackedWords = 2 + LatencyHistogram::kPackedWords;
+    void Pack(double *reals, uint64_t *words) const {
+        reals[0] = m_mean;
+        reals[1] = m_m2;
+        reals[2] = m_jitter;
+        reals[3] = m_lastDelay;
+        words[0] = m_count;
+        words[1] = m_bytes;
+        m_histogram.Pack(words + 2);
+    }
+    void Unpack(const double *reals, const uint64_t *words) {
+        m_mean = reals[0];
+        m_m2 = reals[1];
+        m_jitter = reals[2];
+        m_lastDelay = reals[3];
+        m_count = words[0];
+        m_bytes = words[1];
+        m_histogram.Unpack(words + 2);
+    }
+
+private:
+    uint64_t m_count;
+    double m_mean;
+    double m_m2;
+    double m_jitter;
+    double m_lastDelay;
+    uint64_t m_bytes;
+    LatencyHistogram m_histogram;
+};
+
+// Welford mean/variance of plain values, e.g. one metric over a sweep's seeds
+class RunningMoments {
+public:
+    RunningMoments() : m_count(0), m_mean(0.0), m_m2(0.0) {}
+
+    void Add(double value) {
+        m_count++;
+        double delta = value - m_mean;
+        m_mean += delta / m_count;
+        m_m2 += delta * (value - m_mean);
+    }
+
+    uint64_t GetCount(void) const { return m_count; }
+    double GetMean(void) const { return m_mean; }
+    double GetVariance(void) const { return m_count > 1 ? m_m2 / (m_count - 1) : 0.0; }
+
+private:
+    uint64_t m_count;
+    double m_mean;
+    double m_m2;
+};
+
+// Two-sided 95% Student t quantile
+inline double StudentT95(size_t degreesOfFreedom) {
+    static const double table[] = {
+        0.0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+    };
+    if (degreesOfFreedom < sizeof(table) / sizeof(table[0])) {
+        return table[degreesOfFreedom];
+    }
+    return 1.96;
+}
+
+// MSER: the d <= n/2 minimizing the variance of series[d, n) over (n - d)^2
+inline uint32_t MserTruncation(const std::vector<double>& series) {
+    uint32_t n = series.size();
+    double sum = 0.0, sumSquares = 0.0;
+    double best = std::numeric_limits<double>::max();
+    uint32_t truncation = 0;
+    for (uint32_t d = n; d-- > 0;) {
+        sum += series[d];
+        sumSquares += series[d] * series[d];
+        uint32_t kept = n - d;
+        double statistic = (sumSquares - sum * sum / kept) / ((double)kept * kept);
+        if (d <= n / 2 && kept > 1 && statistic <= best) {
+            best = statistic;
+            truncation = d;
+        }
+    }
+    return truncation;
+}
+
+// Mean and 95% confidence half-width of a series of batch values
+struct BatchMeansEstimate {
+    double mean;
+    double halfWidth;
+    uint32_t batches;       // after merging correlated batches
+};
+
+// Merges adjacent batches while their means are still correlated, as long as
+// at least minBatches remain, then estimates from the independent batches
+inline BatchMeansEstimate BatchMeans(std::vector<double> batches, uint32_t minBatches) {
+    for (;;) {
+        size_t n = batches.size();
+        double mean = std::accumulate(batches.begin(), batches.end(), 0.0) / n;
+        double variance = 0.0, covariance = 0.0;
+        for (size_t i = 0; i < n; ++i) {
+            variance += (batches[i] - mean) * (batches[i] - mean);
+            if (i > 0) {
+                covariance += (batches[i] - mean) * (batches[i - 1] - mean);
+            }
+        }
+        // Lag-1 autocorrelation above 0.2 means the batches are too short to be independent
+        if (variance > 0 && covariance / variance > 0.2 && n / 2 >= minBatches) {
+            for (size_t i = 0; i + 1 < n; i += 2) {
+                batches[i / 2] = (batches[i] + batches[i + 1]) / 2;
+            }
+            batches.resize(n / 2);
+            continue;
+        }
+        BatchMeansEstimate estimate = { mean, StudentT95(n - 1) * std::sqrt(variance / (n - 1) / n), (uint32_t)n };
+        return estimate;
+    }
+}
+
+#endif /* CAMPUS_STATISTICS_H */
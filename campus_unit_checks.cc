@@ -0,0 +1,172 @@
+// Unit checks of the campus simulation's pure parts
+//
+// Exercises the headers of the campus simulation that need no simulated
+// network. Built as its own scratch program next to the simulation; prints
+// every failed check and exits nonzero if there was one.
+
+#include "campus_parsers.h"
+#include "campus_statistics.h"
+#include "content_store.h"
+#include "ns3/nstime.h"
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace ns3;
+
+static uint32_t g_failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; \
+            g_failures++; \
+        } \
+    } while (0)
+
+static bool Near(double value, double expected, double relative) {
+    return std::fabs(value - expected) <= relative * std::fabs(expected);
+}
+
+static void CheckDelayStatistics(void) {
+    LatencyHistogram empty;
+    CHECK(empty.Quantile(0.5) == 0.0);
+
+    // 1..10000 us: quantiles within the histogram's 3%
+    StreamingDelayStats all, low, high;
+    for (uint32_t us = 1; us <= 10000; ++us) {
+        all.Add(MicroSeconds(us), 100);
+        (us <= 5000 ? low : high).Add(MicroSeconds(us), 100);
+    }
+    CHECK(all.GetCount() == 10000 && all.GetBytes() == 1000000);
+    CHECK(Near(all.GetMean(), 5000.5e-6, 1e-9));
+    CHECK(Near(all.GetVariance(), (10000.0 * 10001 / 12) * 1e-12, 1e-6));
+    CHECK(Near(all.GetQuantile(0.5), 5e-3, 0.03));
+    CHECK(Near(all.GetQuantile(0.99), 9.9e-3, 0.03));
+    CHECK(Near(all.GetJitter(), 1e-6, 1e-3));
+
+    // Merging the halves matches accumulating everything at once
+    low.Merge(high);
+    CHECK(low.GetCount() == all.GetCount());
+    CHECK(Near(low.GetMean(), all.GetMean(), 1e-12));
+    CHECK(Near(low.GetVariance(), all.GetVariance(), 1e-9));
+    CHECK(low.GetQuantile(0.99) == all.GetQuantile(0.99));
+
+    // Packing for the ranks loses nothing
+    std::vector<double> reals(StreamingDelayStats::kPackedReals);
+    std::vector<uint64_t> words(StreamingDelayStats::kPackedWords);
+    all.Pack(&reals[0], &words[0]);
+    StreamingDelayStats unpacked;
+    unpacked.Unpack(&reals[0], &words[0]);
+    CHECK(unpacked.GetCount() == all.GetCount() && unpacked.GetBytes() == all.GetBytes());
+    CHECK(unpacked.GetMean() == all.GetMean() && unpacked.GetVariance() == all.GetVariance());
+    CHECK(unpacked.GetJitter() == all.GetJitter() && unpacked.GetQuantile(0.9) == all.GetQuantile(0.9));
+}
+
+static void CheckSteadyState(void) {
+    CHECK(StudentT95(1) == 12.706 && StudentT95(30) == 2.042 && StudentT95(1000) == 1.96);
+
+    // Far from zero, where sum-of-squares variance cancels to nothing
+    RunningMoments moments;
+    CHECK(moments.GetMean() == 0.0 && moments.GetVariance() == 0.0);
+    const double offsets[] = { 4, 7, 13, 16 };
+    for (uint32_t i = 0; i < 4; ++i) {
+        moments.Add(1e9 + offsets[i]);
+    }
+    CHECK(moments.GetCount() == 4 && moments.GetMean() == 1e9 + 10);
+    CHECK(Near(moments.GetVariance(), 30.0, 1e-9));
+
+    // A decaying transient ahead of a steady level is cut, a steady series is kept whole
+    std::vector<double> series;
+    for (uint32_t i = 0; i < 5; ++i) {
+        series.push_back(50.0 - 10 * i);
+    }
+    for (uint32_t i = 0; i < 20; ++i) {
+        series.push_back(i % 2 ? 9.0 : 11.0);
+    }
+    uint32_t truncation = MserTruncation(series);
+    CHECK(truncation >= 4 && truncation <= series.size() / 2);
+    CHECK(MserTruncation(std::vector<double>(series.begin() + 5, series.end())) <= 1);
+
+    BatchMeansEstimate steady = BatchMeans(std::vector<double>(series.begin() + 5, series.end()), 2);
+    CHECK(steady.mean == 10.0 && steady.batches == 20 && steady.halfWidth > 0);
+    BatchMeansEstimate flat = BatchMeans(std::vector<double>(8, 3.0), 2);
+    CHECK(flat.mean == 3.0 && flat.halfWidth == 0.0);
+    // Runs of equal batches are correlated and get merged
+    std::vector<double> runs;
+    for (uint32_t i = 0; i < 16; ++i) {
+        runs.push_back(i / 4 % 2 ? 1.0 : 2.0);
+    }
+    BatchMeansEstimate merged = BatchMeans(runs, 2);
+    CHECK(merged.batches == 8 && merged.mean == 1.5);
+}
+
+static void CheckParsers(void) {
+    std::vector<std::string> parts = SplitString("a,,b,", ',');
+    CHECK(parts.size() == 2 && parts[0] == "a" && parts[1] == "b");
+    CHECK(SplitString("", ';').empty());
+
+    CHECK(ParseUnsigned("42", "value") == 42 && ParseUnsigned("4294967295", "value") == 4294967295u);
+    CHECK(ParseNumber("0.5", "value") == 0.5 && ParseNumber("-2e3", "value") == -2000.0);
+
+    std::vector<uint32_t> ids = ParseIdList("1-3,7");
+    CHECK(ids.size() == 4 && ids[0] == 1 && ids[2] == 3 && ids[3] == 7);
+    CHECK(ParseIdList("").empty());
+
+    std::vector<FailureEvent> failures = ParseFailures("link:3@4-6;node:7@5.5-8");
+    CHECK(failures.size() == 2);
+    CHECK(!failures[0].node && failures[0].id == 3 && failures[0].down == 4 && failures[0].up == 6);
+    CHECK(failures[1].node && failures[1].id == 7 && failures[1].down == 5.5 && failures[1].up == 8);
+}
+
+static void CheckContentStore(void) {
+    ContentStore lru;
+    lru.Configure(CACHE_LRU, 2);
+    lru.Insert(1);
+    lru.Insert(2);
+    CHECK(lru.Lookup(1));
+    lru.Insert(3);
+    CHECK(!lru.Lookup(2) && lru.Lookup(1) && lru.Lookup(3));
+    CHECK(lru.GetSize() == 2 && lru.GetEvictions() == 1);
+
+    ContentStore lfu;
+    lfu.Configure(CACHE_LFU, 2);
+    lfu.Insert(1);
+    lfu.Insert(2);
+    CHECK(lfu.Lookup(1) && lfu.Lookup(1) && lfu.Lookup(2));
+    lfu.Insert(3);
+    CHECK(!lfu.Lookup(2) && lfu.Lookup(1) && lfu.Lookup(3));
+    CHECK(lfu.GetSize() == 2 && lfu.GetEvictions() == 1);
+
+    // ARC keeps a content seen twice over newer one-time contents
+    ContentStore arc;
+    arc.Configure(CACHE_ARC, 2);
+    arc.Insert(1);
+    CHECK(arc.Lookup(1));
+    arc.Insert(2);
+    arc.Insert(3);
+    CHECK(arc.Lookup(1) && !arc.Lookup(2) && arc.Lookup(3));
+    CHECK(arc.GetSize() == 2 && arc.GetEvictions() == 1);
+    // A ghost hit brings the content back without exceeding the capacity
+    arc.Insert(2);
+    CHECK(arc.Lookup(2) && arc.GetSize() == 2);
+
+    // Configure empties the store
+    arc.Configure(CACHE_LRU, 4);
+    CHECK(arc.GetSize() == 0 && !arc.Lookup(1) && arc.GetEvictions() == 0);
+}
+
+int main(void) {
+    CheckDelayStatistics();
+    CheckSteadyState();
+    CheckParsers();
+    CheckContentStore();
+    if (g_failures > 0) {
+        std::cerr << g_failures << " checks failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "All checks passed" << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,41 @@
+#!/bin/sh
+# Checks that a distributed run reports what the sequential run does
+#
+# Runs the default campus once sequentially and once on two MPI ranks, then
+# compares the two summary tables column by column. Numbers must agree to a
+# relative 1e-6; the wall-clock, event-rate and memory columns are skipped.
+# Run from the ns-3 top directory, with ns-3 configured with --enable-mpi and
+# the simulation in scratch. Pass extra simulation options as arguments.
+
+set -e
+program=scratch/network_toplogy_tcp_version_full_metrics
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+./waf --run "$program --metricsOutput=$work/sequential $*"
+./waf --command-template="mpirun -np 2 %s" --run "$program --distributed --metricsOutput=$work/distributed $*"
+
+awk -F, '
+    FNR == 1 { for (i = 1; i <= NF; i++) name[i] = $i; next }
+    FNR == NR { for (i = 1; i <= NF; i++) sequential[i] = $i; next }
+    {
+        for (i = 1; i <= NF; i++) {
+            if (name[i] == "runWallTime" || name[i] == "eventsPerSecond" || name[i] == "peakMemory") {
+                continue;
+            }
+            a = sequential[i]; b = $i;
+            same = a == b;
+            if (!same && a ~ /^-?[0-9.eE+-]+$/ && b ~ /^-?[0-9.eE+-]+$/) {
+                scale = a < 0 ? -a : a;
+                difference = a - b < 0 ? b - a : a - b;
+                same = difference <= 1e-6 * scale;
+            }
+            if (!same) {
+                print name[i] ": sequential " a ", distributed " b;
+                failed = 1;
+            }
+        }
+    }
+    END { exit failed }
+' "$work/sequential_summary.csv" "$work/distributed_summary.csv"
+echo "Sequential and distributed summaries match"
@@ -0,0 +1,188 @@
+// Edge cache replacement policies
+//
+// The content store behind every EdgeCache: which contents a department switch
+// holds and which one it evicts under LRU, LFU or ARC. It only sees content ids,
+// so the campus simulation and its unit checks (campus_unit_checks.cc) share it.
+
+#ifndef CONTENT_STORE_H
+#define CONTENT_STORE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <utility>
+
+enum CachePolicy : uint8_t { CACHE_OFF, CACHE_LRU, CACHE_LFU, CACHE_ARC };
+
+class ContentStore {
+public:
+    ContentStore() : m_policy(CACHE_LRU), m_capacity(1), m_target(0.0), m_clock(0), m_evictions(0) {}
+
+    // Empties the store and sets how it evicts
+    void Configure(CachePolicy policy, uint32_t capacity);
+    // Records an access; true if the content is held
+    bool Lookup(uint32_t content);
+    // Admits a fetched content, evicting another when full
+    void Insert(uint32_t content);
+
+    uint32_t GetSize(void) const { return m_lists[T1].size() + m_lists[T2].size(); }
+    uint64_t GetEvictions(void) const { return m_evictions; }
+
+private:
+    // LRU and LFU keep every content in T1. ARC splits contents seen once (T1)
+    // from those seen again (T2) and remembers recently evicted ids in B1 and B2.
+    enum ListId : uint8_t { T1, T2, B1, B2, LIST_COUNT };
+
+    struct Entry {
+        uint8_t list;
+        std::list<uint32_t>::iterator position;
+        uint64_t frequency;
+        uint64_t lastAccess;
+    };
+    typedef std::unordered_map<uint32_t, Entry> EntryMap;
+
+    void MoveTo(EntryMap::iterator it, ListId list);
+    // Forgets the least recently used id of a list
+    void DropLast(ListId list);
+    // ARC: moves the LRU content of T1 or T2 to its ghost list
+    void Replace(bool ghostOfT2);
+
+    CachePolicy m_policy;
+    uint32_t m_capacity;
+    double m_target;            // ARC's adaptive target size of T1
+    std::list<uint32_t> m_lists[LIST_COUNT];    // most recently used first
+    EntryMap m_entries;
+    std::map<std::pair<uint64_t, uint64_t>, uint32_t> m_byFrequency;  // LFU: (frequency, last access) -> content
+    uint64_t m_clock;
+    uint64_t m_evictions;
+};
+
+inline void ContentStore::Configure(CachePolicy policy, uint32_t capacity) {
+    m_policy = policy;
+    m_capacity = std::max(1u, capacity);
+    m_target = 0.0;
+    for (uint32_t l = 0; l < LIST_COUNT; ++l) {
+        m_lists[l].clear();
+    }
+    m_entries.clear();
+    m_byFrequency.clear();
+    m_clock = 0;
+    m_evictions = 0;
+}
+
+inline void ContentStore::MoveTo(EntryMap::iterator it, ListId list) {
+    m_lists[it->second.list].erase(it->second.position);
+    m_lists[list].push_front(it->first);
+    it->second.list = list;
+    it->second.position = m_lists[list].begin();
+}
+
+inline void ContentStore::DropLast(ListId list) {
+    EntryMap::iterator it = m_entries.find(m_lists[list].back());
+    if (m_policy == CACHE_LFU) {
+        m_byFrequency.erase(std::make_pair(it->second.frequency, it->second.lastAccess));
+    }
+    if (list == T1 || list == T2) {
+        m_evictions++;
+    }
+    m_lists[list].pop_back();
+    m_entries.erase(it);
+}
+
+inline void ContentStore::Replace(bool ghostOfT2) {
+    if (GetSize() < m_capacity) {
+        return;
+    }
+    size_t t1 = m_lists[T1].size();
+    if (t1 > 0 && (t1 > m_target || (ghostOfT2 && t1 == m_target) || m_lists[T2].empty())) {
+        MoveTo(m_entries.find(m_lists[T1].back()), B1);
+    } else {
+        MoveTo(m_entries.find(m_lists[T2].back()), B2);
+    }
+    m_evictions++;
+}
+
+inline bool ContentStore::Lookup(uint32_t content) {
+    EntryMap::iterator it = m_entries.find(content);
+    if (it == m_entries.end() || it->second.list >= B1) {
+        return false;
+    }
+    Entry& entry = it->second;
+    entry.frequency++;
+    if (m_policy == CACHE_LFU) {
+        m_byFrequency.erase(std::make_pair(entry.frequency - 1, entry.lastAccess));
+        entry.lastAccess = ++m_clock;
+        m_byFrequency[std::make_pair(entry.frequency, entry.lastAccess)] = content;
+    } else {
+        // A second access promotes an ARC content to T2
+        MoveTo(it, m_policy == CACHE_ARC ? T2 : T1);
+    }
+    return true;
+}
+
+inline void ContentStore::Insert(uint32_t content) {
+    EntryMap::iterator it = m_entries.find(content);
+    if (it != m_entries.end() && it->second.list < B1) {
+        return;
+    }
+    switch (m_policy) {
+    case CACHE_LFU:
+        if (m_lists[T1].size() >= m_capacity) {
+            // Least frequently used, the least recently used among equals
+            EntryMap::iterator victim = m_entries.find(m_byFrequency.begin()->second);
+            m_byFrequency.erase(m_byFrequency.begin());
+            m_lists[T1].erase(victim->second.position);
+            m_entries.erase(victim);
+            m_evictions++;
+        }
+        break;
+    case CACHE_ARC: {
+        if (it != m_entries.end()) {
+            // Ghost hit: grow the side that would have kept the content, then hold it as frequent
+            double b1 = m_lists[B1].size(), b2 = m_lists[B2].size();
+            bool ghostOfT2 = it->second.list == B2;
+            if (ghostOfT2) {
+                m_target = std::max(0.0, m_target - std::max(b1 / b2, 1.0));
+            } else {
+                m_target = std::min<double>(m_capacity, m_target + std::max(b2 / b1, 1.0));
+            }
+            Replace(ghostOfT2);
+            MoveTo(it, T2);
+            it->second.frequency++;
+            return;
+        }
+        size_t recent = m_lists[T1].size() + m_lists[B1].size();
+        size_t total = recent + m_lists[T2].size() + m_lists[B2].size();
+        if (recent >= m_capacity) {
+            if (m_lists[T1].size() < m_capacity) {
+                DropLast(B1);
+                Replace(false);
+            } else {
+                DropLast(T1);
+            }
+        } else if (total >= m_capacity) {
+            if (total >= 2 * (size_t)m_capacity) {
+                DropLast(B2);
+            }
+            Replace(false);
+        }
+        break;
+    }
+    case CACHE_LRU:
+    default:
+        if (m_lists[T1].size() >= m_capacity) {
+            DropLast(T1);
+        }
+        break;
+    }
+    m_lists[T1].push_front(content);
+    Entry entry = { T1, m_lists[T1].begin(), 1, ++m_clock };
+    m_entries[content] = entry;
+    if (m_policy == CACHE_LFU) {
+        m_byFrequency[std::make_pair(entry.frequency, entry.lastAccess)] = content;
+    }
+}
+
+#endif /* CONTENT_STORE_H */
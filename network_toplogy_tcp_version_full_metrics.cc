@@ -2,13 +2,34 @@
 #include "ns3/network-module.h"
 #include "ns3/internet-module.h"
 #include "ns3/point-to-point-module.h"
+#include "ns3/traffic-control-module.h"
 #include "ns3/applications-module.h"
 #include "ns3/netanim-module.h"
-#include "ns3/flow-monitor-module.h"
 #include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
 #include <string>
 #include <numeric>
+#include <limits>
+#include <cmath>
 #include <vector>
+#include <map>
+#include <list>
+#include <deque>
+#include <unordered_map>
+#include <algorithm>
+#include <thread>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "campus_parsers.h"
+#include "campus_statistics.h"
+#include "content_store.h"
+#ifdef NS3_MPI
+#include "ns3/mpi-interface.h"
+#include <mpi.h>
+#endif
 using namespace ns3;
 
 NS_LOG_COMPONENT_DEFINE ("top");
@@ -18,526 +39,5595 @@ struct NetworkMetrics {
     double avgThroughput;
     double avgLatency;
     double jitter;
-    double bandwidthUtilization;
+    double bandwidthUtilization; // busiest link direction, percent of its DataRate
     double rtt;
     uint32_t totalLostPackets;
     uint32_t totalRxPackets;
     uint32_t controlPackets;
     double networkOverhead;
     double contentRetrievalTime;
-    std::vector<double> packetDelays;
-};
-
-
-void WriteEnhancedStatsToFile(std::string filename, const NetworkMetrics& metrics, double simulationTime) {
-    std::ofstream outFile;
-    outFile.open(filename.c_str(), std::ios::app);
-    outFile << "\n=== Enhanced Network Statistics ===\n";
-    outFile << "Average Throughput: " << metrics.avgThroughput << " Mbps\n";
-    outFile << "Average Latency: " << metrics.avgLatency * 1000 << " ms\n";
-    outFile << "Jitter: " << metrics.jitter * 1000 << " ms\n";
-    outFile << "Bandwidth Utilization: " << metrics.bandwidthUtilization << "%\n";
-    outFile << "Average RTT: " << metrics.rtt * 1000 << " ms\n";
-    outFile << "Packet Loss Ratio: " << (double)metrics.totalLostPackets/(metrics.totalRxPackets + metrics.totalLostPackets) * 100 << "%\n";
-    outFile << "Total Received Packets: " << metrics.totalRxPackets << "\n";
-    outFile << "Total Lost Packets: " << metrics.totalLostPackets << "\n";
-    outFile << "Control Packets: " << metrics.controlPackets << "\n";
-    outFile << "Network Overhead: " << metrics.networkOverhead << "%\n";
-    outFile << "Average Content Retrieval Time: " << metrics.contentRetrievalTime * 1000 << " ms\n";
-    outFile << "Simulation Time: " << simulationTime << " seconds\n";
-    outFile << "================================\n";
-    outFile.close();
-}
-
-
-  // Calculate jitter from packet delays
-  double CalculateJitter(const std::vector<double>& delays) {
-    if (delays.size() < 2) return 0.0;
-    
-    std::vector<double> differences;
-    for (size_t i = 1; i < delays.size(); ++i) {
-        differences.push_back(std::abs(delays[i] - delays[i-1]));
+    double latencyP50;
+    double latencyP99;
+    double latencyP999;
+    double requestLatencyP50;
+    double requestLatencyP99;
+    double requestLatencyP999;
+    double clientQueueDelay;
+    double serverTime;
+    double serverQueueDelay;
+    uint32_t acceptDrops;
+    uint32_t rejectedRequests;
+    uint32_t serverMaxQueueLength;
+    double uplinkMaxToMean;     // busiest department uplink over the mean, upstream bytes
+    uint32_t linkQueueDrops;    // packets dropped by link device queues and queue discs
+    uint32_t maxLinkQueue;      // longest link queue seen, packets
+    double backboneQueueDelay;  // mean time a packet waits per backbone hop, queue disc included
+    double runWallTime;         // wall-clock seconds spent in Simulator::Run
+    double eventsPerSecond;     // scheduler events executed per wall-clock second of the run
+    double peakMemory;          // peak resident set size of the process, MB
+    double steadyStateWarmup;   // seconds of warm-up discarded by the convergence monitor
+    double steadyStatePrecision; // worst relative 95% half-width of its batch means
+    uint32_t workloadFlows;     // traffic-matrix flows started
+    double workloadCompletedRatio; // TCP workload flows completed before the end of the run
+    double workloadFctP99;      // p99 completion time of the completed TCP workload flows
+    double workloadDeadlineMissRatio; // constant-rate packets lost or later than their deadline
+    double cacheHitRatio;       // named requests answered by the department edge caches
+    double cacheBytesSaved;     // origin traffic the edge caches avoided, bytes
+    uint32_t failureLostPackets;
+    uint32_t failureRetransmissions;
+    double failureRecoveryTime; // longest time to first delivery after a failure, affected flows
+    double failureThroughputDip;
+    std::vector<double> departmentRetrieval; // mean content retrieval time by client department, seconds
+};
+
+enum ArrivalProcess : uint8_t { ARRIVAL_CONSTANT, ARRIVAL_POISSON, ARRIVAL_ONOFF };
+enum PayloadDistribution : uint8_t { PAYLOAD_FIXED, PAYLOAD_UNIFORM, PAYLOAD_EXPONENTIAL, PAYLOAD_PARETO };
+
+// Request generation of one CustomClient
+struct ClientLoadConfig {
+    ArrivalProcess arrival;
+    double rate;                // requests per second, 0 = one per message interval
+    double burstOn;             // mean on/off period lengths in seconds
+    double burstOff;
+    PayloadDistribution payload;
+    uint32_t payloadMin;        // uniform lower bound
+    uint32_t payloadMax;        // uniform upper bound, cap for the others
+    double paretoShape;
+    uint32_t connections;
+    uint32_t maxOutstanding;    // unanswered requests per connection, 0 = unlimited
+    uint32_t backlogLimit;      // requests waiting for a free connection
+    uint32_t contentCount;      // named contents requested with Zipf popularity, 0 = unnamed requests
+    double zipfExponent;
+};
+
+static ClientLoadConfig DefaultClientLoad(void) {
+    ClientLoadConfig load = { ARRIVAL_CONSTANT, 0.0, 1.0, 1.0, PAYLOAD_FIXED, 64, 65536, 1.5, 1, 0, 10000, 0, 0.8 };
+    return load;
+}
+
+enum ServiceTimeModel : uint8_t { SERVICE_FIXED, SERVICE_EXPONENTIAL };
+
+// Request processing of the CustomServer
+struct ServerServiceConfig {
+    ServiceTimeModel model;
+    double meanServiceTime;     // seconds, 0 = respond immediately
+    uint32_t workers;           // requests served concurrently, 0 = unlimited
+    uint32_t queueLimit;        // requests waiting for a worker, 0 = unlimited
+    uint32_t maxConnections;    // open connections, 0 = unlimited
+    uint32_t contentSize;       // response bytes of a named content
+};
+
+static ServerServiceConfig DefaultServerService(void) {
+    ServerServiceConfig service = { SERVICE_FIXED, 0.0, 1, 0, 0, 1024 };
+    return service;
+}
+
+// Content caches on the department switches
+struct EdgeCacheConfig {
+    CachePolicy policy;
+    uint32_t capacity;          // contents held per cache
+};
+
+enum MetricsFormat : uint8_t { METRICS_CSV, METRICS_JSON, METRICS_BINARY };
+
+enum EcmpMode : uint8_t { ECMP_OFF, ECMP_FLOW, ECMP_FLOWLET };
+
+// Animation slice written with the run
+struct AnimationConfig {
+    std::string file;               // empty = no animation
+    double start;                   // seconds
+    double stop;                    // seconds, 0 = end of run
+    uint64_t maxPackets;            // packets per trace file before NetAnim starts the next one
+};
+
+static AnimationConfig DefaultAnimation(void) {
+    AnimationConfig animation = { "animation1.xml", 0.0, 0.0, 100000 };
+    return animation;
+}
+
+// Settings for one simulation run
+struct ScenarioConfig {
+    std::string topologyFile;
+    uint32_t departmentCount;
+    uint32_t hostsPerDepartment;
+    uint32_t coreCount;
+    uint32_t serverNode;
+    uint32_t clientNode;
+    std::string dataRate;       // overrides every link of the topology when set
+    std::string delay;
+    EcmpMode ecmp;              // spreading over equal-cost backbone paths
+    double flowletGap;          // seconds of idle time that start a new flowlet
+    std::vector<FailureEvent> failures;
+    double convergenceDelay;    // seconds before routers act on a link state change
+    std::string tcpVariant;     // congestion control, ns3::Tcp<variant>
+    std::string queueDisc;      // root queue disc of backbone links, empty = traffic-control default
+    std::string scheduler;      // event scheduler: map, heap, calendar, list or priority
+    uint32_t clientCount;
+    double messageInterval;     // seconds between client messages
+    std::string trafficMatrix;  // department traffic matrix file, empty = no workload
+    double stopTime;            // seconds; the run may stop earlier once converged
+    double precision;           // target relative 95% half-width of the key metrics, 0 = run to stopTime
+    double lossTolerance;       // absolute 95% half-width that settles the loss ratio whatever its mean
+    double batchInterval;       // seconds per convergence batch
+    uint32_t minBatches;        // batches kept after warm-up before convergence is judged
+    ClientLoadConfig load;
+    ServerServiceConfig service;
+    EdgeCacheConfig cache;
+    uint32_t seed;
+    bool writeArtifacts;        // pcap, NetAnim and metrics files
+    double sampleInterval;      // seconds between time-series samples, 0 = off
+    std::string timeSeriesFile;
+    MetricsFormat metricsFormat;
+    std::string metricsOutput;  // base name of the metrics files
+    std::string traceFile;      // binary event trace, empty = off
+    AnimationConfig animation;
+    uint32_t traceCapacity;     // events kept in the trace ring
+    uint32_t topLinks;          // most utilized link directions reported, 0 = all
+    std::string selfBenchmarkFile; // simulator performance rows appended here, empty = off
+    std::string selfBenchmarkLabel; // identifies the build in those rows, e.g. a commit
+};
+
+
+// Metrics of one run flattened in a fixed order, shared by the metrics files and sweeps
+static const char *kMetricNames[] = {
+    "avgThroughput", "avgLatency", "jitter", "bandwidthUtilization", "rtt", "lossRatio",
+    "totalRxPackets", "totalLostPackets", "networkOverhead", "contentRetrievalTime",
+    "latencyP50", "latencyP99", "latencyP999", "requestLatencyP50", "requestLatencyP99", "requestLatencyP999",
+    "clientQueueDelay", "serverTime", "serverQueueDelay", "acceptDrops", "rejectedRequests", "serverMaxQueueLength",
+    "uplinkMaxToMean", "linkQueueDrops", "maxLinkQueue", "backboneQueueDelay", "runWallTime", "eventsPerSecond", "peakMemory",
+    "steadyStateWarmup", "steadyStatePrecision",
+    "workloadFlows", "workloadCompletedRatio", "workloadFctP99", "workloadDeadlineMissRatio",
+    "cacheHitRatio", "cacheBytesSaved",
+    "failureLostPackets", "failureRetransmissions", "failureRecoveryTime", "failureThroughputDip"
+};
+static const size_t kMetricCount = sizeof(kMetricNames) / sizeof(kMetricNames[0]);
+
+static size_t MetricIndex(const std::string& name) {
+    for (size_t m = 0; m < kMetricCount; ++m) {
+        if (name == kMetricNames[m]) {
+            return m;
+        }
+    }
+    NS_FATAL_ERROR("Unknown metric " << name);
+    return 0;
+}
+
+struct MetricsSample {
+    double values[kMetricCount];
+};
+
+static MetricsSample FlattenMetrics(const NetworkMetrics& metrics) {
+    uint32_t packets = metrics.totalRxPackets + metrics.totalLostPackets;
+    MetricsSample sample = { {
+        metrics.avgThroughput, metrics.avgLatency, metrics.jitter, metrics.bandwidthUtilization, metrics.rtt,
+        packets > 0 ? (double)metrics.totalLostPackets / packets : 0.0,
+        (double)metrics.totalRxPackets, (double)metrics.totalLostPackets,
+        metrics.networkOverhead, metrics.contentRetrievalTime,
+        metrics.latencyP50, metrics.latencyP99, metrics.latencyP999,
+        metrics.requestLatencyP50, metrics.requestLatencyP99, metrics.requestLatencyP999,
+        metrics.clientQueueDelay, metrics.serverTime,
+        metrics.serverQueueDelay, (double)metrics.acceptDrops, (double)metrics.rejectedRequests,
+        (double)metrics.serverMaxQueueLength, metrics.uplinkMaxToMean,
+        (double)metrics.linkQueueDrops, (double)metrics.maxLinkQueue, metrics.backboneQueueDelay,
+        metrics.runWallTime, metrics.eventsPerSecond, metrics.peakMemory,
+        metrics.steadyStateWarmup, metrics.steadyStatePrecision,
+        (double)metrics.workloadFlows, metrics.workloadCompletedRatio, metrics.workloadFctP99,
+        metrics.workloadDeadlineMissRatio,
+        metrics.cacheHitRatio, metrics.cacheBytesSaved,
+        (double)metrics.failureLostPackets, (double)metrics.failureRetransmissions,
+        metrics.failureRecoveryTime, metrics.failureThroughputDip
+    } };
+    return sample;
+}
+
+
+// Structured metrics export
+//
+// Results are tables with string key columns followed by numeric value columns;
+// times are in seconds. Every table is built in memory and each output file is
+// written with a single call:
+//   csv     <base>_<table>.csv, one file per table
+//   json    <base>.json, {"schema": 1, "<table>": [{column: value, ...}, ...], ...}
+//   binary  <base>.nmet, columnar, host byte order:
+//           "NMET" u32 version u32 tables, then per table: str name, u32 keys,
+//           u32 values, u32 rows, column names, keys row-major (str),
+//           values column-major (f64); str = u32 length + bytes
+
+static const uint32_t kMetricsSchemaVersion = 2;
+
+class MetricsTable {
+public:
+    MetricsTable(std::string name, std::vector<std::string> keyColumns, std::vector<std::string> valueColumns)
+        : m_name(name), m_keyColumns(keyColumns), m_valueColumns(valueColumns), m_rows(0) {}
+
+    void AddRow(const std::string *keys, const double *values) {
+        m_keys.insert(m_keys.end(), keys, keys + m_keyColumns.size());
+        m_values.insert(m_values.end(), values, values + m_valueColumns.size());
+        m_rows++;
+    }
+    void AddRow(std::initializer_list<std::string> keys, std::initializer_list<double> values) {
+        NS_ASSERT(keys.size() == m_keyColumns.size() && values.size() == m_valueColumns.size());
+        AddRow(keys.begin(), values.begin());
+    }
+
+    const std::string& GetName(void) const { return m_name; }
+    uint32_t GetNRows(void) const { return m_rows; }
+
+    void WriteCsv(std::ostream& os) const;
+    void WriteJson(std::ostream& os) const;
+    void WriteBinary(std::ostream& os) const;
+
+private:
+    std::string m_name;
+    std::vector<std::string> m_keyColumns;
+    std::vector<std::string> m_valueColumns;
+    std::vector<std::string> m_keys;     // row-major
+    std::vector<double> m_values;        // row-major
+    uint32_t m_rows;
+};
+
+static void WriteJsonString(std::ostream& os, const std::string& text) {
+    os << '"';
+    for (size_t i = 0; i < text.size(); ++i) {
+        char c = text[i];
+        if (c == '"' || c == '\\') {
+            os << '\\' << c;
+        } else if ((unsigned char)c < 0x20) {
+            os << "\\u00" << "0123456789abcdef"[(c >> 4) & 0xf] << "0123456789abcdef"[c & 0xf];
+        } else {
+            os << c;
+        }
+    }
+    os << '"';
+}
+
+static void WriteCsvField(std::ostream& os, const std::string& text) {
+    if (text.find_first_of(",\"\n") == std::string::npos) {
+        os << text;
+        return;
+    }
+    os << '"';
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (text[i] == '"') {
+            os << '"';
+        }
+        os << text[i];
+    }
+    os << '"';
+}
+
+void MetricsTable::WriteCsv(std::ostream& os) const {
+    for (size_t c = 0; c < m_keyColumns.size() + m_valueColumns.size(); ++c) {
+        os << (c ? "," : "") << (c < m_keyColumns.size() ? m_keyColumns[c] : m_valueColumns[c - m_keyColumns.size()]);
+    }
+    os << "\n";
+    for (uint32_t r = 0; r < m_rows; ++r) {
+        for (size_t k = 0; k < m_keyColumns.size(); ++k) {
+            if (k) {
+                os << ",";
+            }
+            WriteCsvField(os, m_keys[r * m_keyColumns.size() + k]);
+        }
+        for (size_t v = 0; v < m_valueColumns.size(); ++v) {
+            os << (v || !m_keyColumns.empty() ? "," : "") << m_values[r * m_valueColumns.size() + v];
+        }
+        os << "\n";
+    }
+}
+
+void MetricsTable::WriteJson(std::ostream& os) const {
+    os << "[";
+    for (uint32_t r = 0; r < m_rows; ++r) {
+        os << (r ? ",\n  {" : "\n  {");
+        for (size_t k = 0; k < m_keyColumns.size(); ++k) {
+            os << (k ? ", " : "");
+            WriteJsonString(os, m_keyColumns[k]);
+            os << ": ";
+            WriteJsonString(os, m_keys[r * m_keyColumns.size() + k]);
+        }
+        for (size_t v = 0; v < m_valueColumns.size(); ++v) {
+            double value = m_values[r * m_valueColumns.size() + v];
+            os << (v || !m_keyColumns.empty() ? ", " : "");
+            WriteJsonString(os, m_valueColumns[v]);
+            os << ": ";
+            if (std::isfinite(value)) {
+                os << value;
+            } else {
+                os << "null";
+            }
+        }
+        os << "}";
+    }
+    os << "\n]";
+}
+
+static void WriteBinaryU32(std::ostream& os, uint32_t value) {
+    os.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+static void WriteBinaryString(std::ostream& os, const std::string& text) {
+    WriteBinaryU32(os, text.size());
+    os.write(text.data(), text.size());
+}
+
+void MetricsTable::WriteBinary(std::ostream& os) const {
+    WriteBinaryString(os, m_name);
+    WriteBinaryU32(os, m_keyColumns.size());
+    WriteBinaryU32(os, m_valueColumns.size());
+    WriteBinaryU32(os, m_rows);
+    for (size_t k = 0; k < m_keyColumns.size(); ++k) {
+        WriteBinaryString(os, m_keyColumns[k]);
+    }
+    for (size_t v = 0; v < m_valueColumns.size(); ++v) {
+        WriteBinaryString(os, m_valueColumns[v]);
+    }
+    for (size_t i = 0; i < m_keys.size(); ++i) {
+        WriteBinaryString(os, m_keys[i]);
+    }
+    for (size_t v = 0; v < m_valueColumns.size(); ++v) {
+        for (uint32_t r = 0; r < m_rows; ++r) {
+            double value = m_values[r * m_valueColumns.size() + v];
+            os.write(reinterpret_cast<const char *>(&value), sizeof(value));
+        }
+    }
+}
+
+static void WriteWholeFile(const std::string& filename, const std::string& contents) {
+    std::ofstream out(filename.c_str(), std::ios::binary);
+    out.write(contents.data(), contents.size());
+}
+
+void WriteMetrics(std::string basename, MetricsFormat format, const std::vector<const MetricsTable *>& tables) {
+    std::ostringstream buffer;
+    buffer.precision(9);
+    if (format == METRICS_CSV) {
+        for (size_t t = 0; t < tables.size(); ++t) {
+            buffer.str("");
+            tables[t]->WriteCsv(buffer);
+            WriteWholeFile(basename + "_" + tables[t]->GetName() + ".csv", buffer.str());
+        }
+    } else if (format == METRICS_JSON) {
+        buffer << "{\"schema\": " << kMetricsSchemaVersion;
+        for (size_t t = 0; t < tables.size(); ++t) {
+            buffer << ",\n";
+            WriteJsonString(buffer, tables[t]->GetName());
+            buffer << ": ";
+            tables[t]->WriteJson(buffer);
+        }
+        buffer << "\n}\n";
+        WriteWholeFile(basename + ".json", buffer.str());
+    } else {
+        buffer.write("NMET", 4);
+        WriteBinaryU32(buffer, kMetricsSchemaVersion);
+        WriteBinaryU32(buffer, tables.size());
+        for (size_t t = 0; t < tables.size(); ++t) {
+            tables[t]->WriteBinary(buffer);
+        }
+        WriteWholeFile(basename + ".nmet", buffer.str());
+    }
+}
+
+
+// Run configuration as key columns of the summary table
+static void DescribeScenario(const ScenarioConfig& config, std::vector<std::string>& names, std::vector<std::string>& values) {
+    static const char *arrivals[] = { "constant", "poisson", "onoff" };
+    static const char *payloads[] = { "fixed", "uniform", "exponential", "pareto" };
+    static const char *serviceModels[] = { "fixed", "exponential" };
+    static const char *cachePolicies[] = { "off", "lru", "lfu", "arc" };
+    std::ostringstream text;
+    names.clear();
+    values.clear();
+#define DESCRIBE(name, value) do { text.str(""); text << value; names.push_back(name); values.push_back(text.str()); } while (0)
+    DESCRIBE("topology", (config.departmentCount > 0 ? "generated" : config.topologyFile.empty() ? "default" : config.topologyFile));
+    DESCRIBE("departments", config.departmentCount);
+    DESCRIBE("hostsPerDepartment", config.hostsPerDepartment);
+    DESCRIBE("cores", config.coreCount);
+    DESCRIBE("serverNode", config.serverNode);
+    DESCRIBE("clientNode", config.clientNode);
+    DESCRIBE("dataRate", config.dataRate);
+    DESCRIBE("delay", config.delay);
+    DESCRIBE("tcp", config.tcpVariant);
+    DESCRIBE("queueDisc", config.queueDisc.empty() ? "default" : config.queueDisc);
+    DESCRIBE("scheduler", config.scheduler);
+    DESCRIBE("ecmp", (config.ecmp == ECMP_FLOWLET ? "flowlet" : config.ecmp == ECMP_FLOW ? "flow" : "off"));
+    DESCRIBE("clients", config.clientCount);
+    DESCRIBE("interval", config.messageInterval);
+    DESCRIBE("arrival", arrivals[config.load.arrival]);
+    DESCRIBE("rate", config.load.rate);
+    DESCRIBE("payload", payloads[config.load.payload]);
+    DESCRIBE("connections", config.load.connections);
+    DESCRIBE("pipeline", config.load.maxOutstanding);
+    DESCRIBE("serviceModel", serviceModels[config.service.model]);
+    DESCRIBE("serviceTime", config.service.meanServiceTime);
+    DESCRIBE("workers", config.service.workers);
+    DESCRIBE("queueLimit", config.service.queueLimit);
+    DESCRIBE("maxConnections", config.service.maxConnections);
+    DESCRIBE("cache", cachePolicies[config.cache.policy]);
+    DESCRIBE("cacheCapacity", config.cache.capacity);
+    DESCRIBE("contents", config.load.contentCount);
+    DESCRIBE("zipf", config.load.zipfExponent);
+    text.str("");
+    for (size_t f = 0; f < config.failures.size(); ++f) {
+        const FailureEvent& event = config.failures[f];
+        text << (f ? ";" : "") << (event.node ? "node:" : "link:") << event.id << "@" << event.down << "-" << event.up;
+    }
+    names.push_back("failures");
+    values.push_back(text.str());
+    DESCRIBE("trafficMatrix", config.trafficMatrix);
+    DESCRIBE("stopTime", config.stopTime);
+    DESCRIBE("precision", config.precision);
+    DESCRIBE("lossTolerance", config.lossTolerance);
+    DESCRIBE("seed", config.seed);
+#undef DESCRIBE
+}
+
+
+// Campus topology description
+//
+// The campus is described as text, one record per line:
+//   access-link <rate> <delay>            host <-> department switch links declared after it
+//   backbone-link <rate> <delay>          department switch <-> core links declared after it
+//   core <node> <x> <y> <subnet> <name>   multilayer switch with its backbone subnet
+//   department <node> <x> <y> <subnet> <name>
+//   host <node> <department-node> <x> <y>
+// Every department switch is linked to every core. Links are installed hosts
+// first, then core by core, and addresses are handed out per subnet in that order.
+static const char *kDefaultCampusTopology =
+    "access-link 1Mbps 2ms\n"
+    "backbone-link 1Mbps 2ms\n"
+    "core 7 50 20 192.168.100.0/24 Multilayer1\n"
+    "core 25 118 20 192.168.110.0/24 Multilayer2\n"
+    "department 0 5 60 192.168.10.0/24 Chaine Info\n"
+    "host 1 0 0 90\n"
+    "host 2 0 10 90\n"
+    "host 3 0 20 90\n"
+    "department 4 30 60 192.168.20.0/24 Noyau\n"
+    "host 5 4 25 90\n"
+    "host 6 4 35 90\n"
+    "department 8 50 60 192.168.30.0/24 FibreHome\n"
+    "host 9 8 45 90\n"
+    "host 10 8 55 90\n"
+    "department 11 70 60 192.168.40.0/24 Commutation\n"
+    "host 12 11 65 90\n"
+    "host 13 11 75 90\n"
+    "host 14 11 85 90\n"
+    "department 15 90 60 192.168.50.0/24 Ericson\n"
+    "host 16 15 90 90\n"
+    "department 17 110 60 192.168.60.0/24 Chaine mécanique\n"
+    "host 18 17 110 90\n"
+    "department 19 130 60 192.168.70.0/24 Finance\n"
+    "host 20 19 130 90\n"
+    "department 21 150 60 192.168.80.0/24 Infermerie\n"
+    "host 22 21 150 90\n"
+    "department 23 170 60 192.168.90.0/24 PC\n"
+    "host 24 23 170 90\n";
+
+enum NodeRole : uint8_t { ROLE_UNSET, ROLE_CORE, ROLE_DEPARTMENT, ROLE_HOST };
+
+static const uint32_t kNoDepartment = 0xffffffff;
+
+struct TopologyNode {
+    NodeRole role;
+    uint32_t department;   // index into CampusTopology::departments
+    double x;
+    double y;
+    std::string description;
+    uint32_t systemId;     // MPI rank simulating the node
+};
+
+struct TopologyDepartment {
+    uint32_t switchNode;
+    uint32_t subnet;
+    uint32_t backboneProfile;
+    std::string name;
+};
+
+struct TopologySubnet {
+    Ipv4Address network;
+    Ipv4Mask mask;
+};
+
+// Addresses of a department subnet, for prefix lookups
+struct DepartmentPrefix {
+    uint32_t first;        // network address
+    uint32_t last;         // broadcast address
+    uint32_t department;
+};
+
+struct LinkProfile {
+    std::string dataRate;
+    std::string delay;
+};
+
+struct TopologyLink {
+    uint32_t nodeA;
+    uint32_t nodeB;
+    uint32_t subnet;
+    uint32_t profile;
+};
+
+class CampusTopology {
+public:
+    CampusTopology();
+
+    void LoadDefault(void);
+    void LoadFile(std::string filename);
+    void Parse(std::istream& in);
+    void Generate(uint32_t departmentCount, uint32_t hostsPerDepartment, uint32_t coreCount);
+    // Gives every link the same rate and delay
+    void SetLinkProfile(std::string dataRate, std::string delay);
+
+    // Spreads departments (with their hosts) and cores over ranks in contiguous
+    // blocks, so only backbone links cross ranks; their delay is the lookahead
+    void Partition(uint32_t ranks);
+    // Creates nodes, links and addresses in one pass over the link table
+    void Build(PointToPointHelper& p2p);
+    void ApplyAnimationLayout(AnimationInterface& anim) const;
+
+    uint32_t GetNNodes(void) const { return nodeInfo.size(); }
+    uint32_t GetNLinks(void) const { return links.size(); }
+    Ptr<Node> GetNode(uint32_t id) const { return nodes.Get(id); }
+    // First address assigned to a node (its access link for hosts)
+    Ipv4Address GetNodeAddress(uint32_t id) const;
+    // First device installed on a node
+    Ptr<NetDevice> GetNodeDevice(uint32_t id) const;
+    // Department owning an interface address, kNoDepartment for cores and unknown addresses
+    uint32_t GetDepartmentOfAddress(Ipv4Address address) const;
+    // Department whose subnet holds the address, else the department owning the
+    // interface (switch backbone addresses); kNoDepartment for cores
+    uint32_t FindDepartment(Ipv4Address address) const;
+
+    NodeContainer nodes;
+    std::vector<TopologyNode> nodeInfo;
+    std::vector<TopologyDepartment> departments;
+    std::vector<uint32_t> cores;
+    std::vector<TopologyLink> links;
+    // Link i owns entries 2*i (nodeA side) and 2*i+1 (nodeB side)
+    std::vector<Ptr<NetDevice>> linkDevices;
+    std::vector<Ipv4Address> linkAddresses;
+    std::vector<uint32_t> nodeFirstLink;   // 2*link+side of the first endpoint on each node
+    std::unordered_map<uint32_t, uint32_t> addressNode;
+    double setupTimeMs;
+
+private:
+    TopologyNode& DeclareNode(uint32_t id, NodeRole role, double x, double y, uint32_t line);
+    uint32_t AddSubnet(std::string cidr, uint32_t line);
+    uint32_t AddSubnet(Ipv4Address network, Ipv4Mask mask);
+    uint32_t AddProfile(std::string dataRate, std::string delay);
+    void Clear(void);
+
+    std::vector<TopologySubnet> m_subnets;
+    std::vector<LinkProfile> m_profiles;
+    std::vector<uint32_t> m_coreSubnets;
+    std::vector<DepartmentPrefix> m_prefixes;   // sorted by network address, built with the topology
+};
+
+CampusTopology::CampusTopology() : setupTimeMs(0.0) {}
+
+void CampusTopology::Clear(void) {
+    nodeInfo.clear();
+    departments.clear();
+    cores.clear();
+    links.clear();
+    m_subnets.clear();
+    m_profiles.clear();
+    m_coreSubnets.clear();
+    m_prefixes.clear();
+}
+
+void CampusTopology::LoadDefault(void) {
+    std::istringstream in(kDefaultCampusTopology);
+    Parse(in);
+}
+
+void CampusTopology::LoadFile(std::string filename) {
+    std::ifstream in(filename.c_str());
+    if (!in.is_open()) {
+        NS_FATAL_ERROR("Cannot open topology file " << filename);
+    }
+    Parse(in);
+}
+
+TopologyNode& CampusTopology::DeclareNode(uint32_t id, NodeRole role, double x, double y, uint32_t line) {
+    if (id >= nodeInfo.size()) {
+        TopologyNode unset = { ROLE_UNSET, kNoDepartment, 0.0, 0.0, "", 0 };
+        nodeInfo.resize(id + 1, unset);
+    }
+    TopologyNode& node = nodeInfo[id];
+    if (node.role != ROLE_UNSET) {
+        NS_FATAL_ERROR("Topology line " << line << ": node " << id << " declared twice");
+    }
+    node.role = role;
+    node.x = x;
+    node.y = y;
+    return node;
+}
+
+uint32_t CampusTopology::AddSubnet(std::string cidr, uint32_t line) {
+    std::string::size_type slash = cidr.find('/');
+    if (slash == std::string::npos) {
+        NS_FATAL_ERROR("Topology line " << line << ": subnet " << cidr << " is not in a.b.c.d/len form");
+    }
+    return AddSubnet(Ipv4Address(cidr.substr(0, slash).c_str()), Ipv4Mask(cidr.substr(slash).c_str()));
+}
+
+uint32_t CampusTopology::AddSubnet(Ipv4Address network, Ipv4Mask mask) {
+    TopologySubnet subnet = { network, mask };
+    m_subnets.push_back(subnet);
+    return m_subnets.size() - 1;
+}
+
+uint32_t CampusTopology::AddProfile(std::string dataRate, std::string delay) {
+    LinkProfile profile = { dataRate, delay };
+    m_profiles.push_back(profile);
+    return m_profiles.size() - 1;
+}
+
+void CampusTopology::Parse(std::istream& in) {
+    Clear();
+    uint32_t accessProfile = AddProfile("1Mbps", "2ms");
+    uint32_t backboneProfile = accessProfile;
+    std::vector<TopologyLink> accessLinks;   // nodeA holds the declared department switch
+
+    std::string text;
+    uint32_t line = 0;
+    while (std::getline(in, text)) {
+        ++line;
+        std::istringstream fields(text);
+        std::string keyword;
+        if (!(fields >> keyword) || keyword[0] == '#') {
+            continue;
+        }
+        if (keyword == "access-link" || keyword == "backbone-link") {
+            std::string rate, delay;
+            if (!(fields >> rate >> delay)) {
+                NS_FATAL_ERROR("Topology line " << line << ": expected " << keyword << " <rate> <delay>");
+            }
+            (keyword == "access-link" ? accessProfile : backboneProfile) = AddProfile(rate, delay);
+        } else if (keyword == "core" || keyword == "department") {
+            uint32_t id;
+            double x, y;
+            std::string cidr, name;
+            if (!(fields >> id >> x >> y >> cidr)) {
+                NS_FATAL_ERROR("Topology line " << line << ": expected " << keyword << " <node> <x> <y> <subnet> <name>");
+            }
+            std::getline(fields >> std::ws, name);
+            uint32_t subnet = AddSubnet(cidr, line);
+            if (keyword == "core") {
+                DeclareNode(id, ROLE_CORE, x, y, line).description = name;
+                cores.push_back(id);
+                m_coreSubnets.push_back(subnet);
+            } else {
+                TopologyNode& node = DeclareNode(id, ROLE_DEPARTMENT, x, y, line);
+                node.description = name;
+                node.department = departments.size();
+                TopologyDepartment department = { id, subnet, backboneProfile, name };
+                departments.push_back(department);
+            }
+        } else if (keyword == "host") {
+            uint32_t id, switchNode;
+            double x, y;
+            if (!(fields >> id >> switchNode >> x >> y)) {
+                NS_FATAL_ERROR("Topology line " << line << ": expected host <node> <department-node> <x> <y>");
+            }
+            DeclareNode(id, ROLE_HOST, x, y, line);
+            TopologyLink link = { switchNode, id, 0, accessProfile };
+            accessLinks.push_back(link);
+        } else {
+            NS_FATAL_ERROR("Topology line " << line << ": unknown record '" << keyword << "'");
+        }
+    }
+
+    for (uint32_t id = 0; id < nodeInfo.size(); ++id) {
+        if (nodeInfo[id].role == ROLE_UNSET) {
+            NS_FATAL_ERROR("Topology leaves node " << id << " undeclared");
+        }
+    }
+
+    // Access links first, then every core to every department switch
+    links.reserve(accessLinks.size() + cores.size() * departments.size());
+    for (size_t i = 0; i < accessLinks.size(); ++i) {
+        TopologyLink link = accessLinks[i];
+        if (link.nodeA >= nodeInfo.size() || nodeInfo[link.nodeA].role != ROLE_DEPARTMENT) {
+            NS_FATAL_ERROR("Host " << link.nodeB << " refers to unknown department switch " << link.nodeA);
+        }
+        uint32_t department = nodeInfo[link.nodeA].department;
+        nodeInfo[link.nodeB].department = department;
+        link.subnet = departments[department].subnet;
+        links.push_back(link);
+    }
+    for (size_t c = 0; c < cores.size(); ++c) {
+        for (size_t d = 0; d < departments.size(); ++d) {
+            TopologyLink link = { cores[c], departments[d].switchNode, m_coreSubnets[c], departments[d].backboneProfile };
+            links.push_back(link);
+        }
+    }
+}
+
+// Smallest prefix length whose subnet holds the given number of addresses
+static uint32_t PrefixLengthFor(uint32_t addresses) {
+    uint32_t hostBits = 2;
+    while ((1u << hostBits) - 2 < addresses) {
+        ++hostBits;
+    }
+    return 32 - hostBits;
+}
+
+void CampusTopology::Generate(uint32_t departmentCount, uint32_t hostsPerDepartment, uint32_t coreCount) {
+    std::ostringstream text;
+    text << "access-link 1Mbps 2ms\n";
+    text << "backbone-link 1Mbps 2ms\n";
+
+    uint32_t perDepartment = 1 + hostsPerDepartment;
+    uint32_t firstCore = departmentCount * perDepartment;
+
+    // Backbone subnets come from 172.16.0.0/12, department subnets from 10.0.0.0/8
+    uint32_t backbonePrefix = PrefixLengthFor(2 * departmentCount);
+    uint32_t backboneBase = Ipv4Address("172.16.0.0").Get();
+    for (uint32_t c = 0; c < coreCount; ++c) {
+        double x = (departmentCount * 20.0) * (c + 1) / (coreCount + 1);
+        text << "core " << firstCore + c << " " << x << " 20 "
+             << Ipv4Address(backboneBase + (c << (32 - backbonePrefix))) << "/" << backbonePrefix
+             << " Multilayer" << c + 1 << "\n";
+    }
+
+    uint32_t departmentPrefix = PrefixLengthFor(2 * hostsPerDepartment);
+    uint32_t departmentBase = Ipv4Address("10.0.0.0").Get();
+    for (uint32_t d = 0; d < departmentCount; ++d) {
+        uint32_t switchNode = d * perDepartment;
+        double x = d * 20.0;
+        text << "department " << switchNode << " " << x << " 60 "
+             << Ipv4Address(departmentBase + (d << (32 - departmentPrefix))) << "/" << departmentPrefix
+             << " Department" << d + 1 << "\n";
+        for (uint32_t h = 0; h < hostsPerDepartment; ++h) {
+            text << "host " << switchNode + 1 + h << " " << switchNode << " "
+                 << x + h * 20.0 / hostsPerDepartment << " 90\n";
+        }
+    }
+
+    std::istringstream in(text.str());
+    Parse(in);
+}
+
+void CampusTopology::SetLinkProfile(std::string dataRate, std::string delay) {
+    for (size_t i = 0; i < m_profiles.size(); ++i) {
+        m_profiles[i].dataRate = dataRate;
+        m_profiles[i].delay = delay;
+    }
+}
+
+void CampusTopology::Build(PointToPointHelper& p2p) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for (uint32_t id = 0; id < nodeInfo.size(); ++id) {
+        nodes.Create(1, nodeInfo[id].systemId);
+    }
+    InternetStackHelper internet;
+    internet.Install(nodes);
+    // Fixed streams keep every rank, and a sequential run, drawing the same numbers
+    internet.AssignStreams(nodes, 0);
+
+    std::vector<Ipv4AddressHelper> addressHelpers(m_subnets.size());
+    for (size_t i = 0; i < m_subnets.size(); ++i) {
+        addressHelpers[i].SetBase(m_subnets[i].network, m_subnets[i].mask);
+    }
+
+    linkDevices.resize(2 * links.size());
+    linkAddresses.resize(2 * links.size());
+    addressNode.reserve(2 * links.size());
+    nodeFirstLink.assign(nodeInfo.size(), 0xffffffff);
+    uint32_t currentProfile = 0xffffffff;
+    for (size_t i = 0; i < links.size(); ++i) {
+        const TopologyLink& link = links[i];
+        if (link.profile != currentProfile) {
+            currentProfile = link.profile;
+            p2p.SetDeviceAttribute("DataRate", StringValue(m_profiles[currentProfile].dataRate));
+            p2p.SetChannelAttribute("Delay", StringValue(m_profiles[currentProfile].delay));
+        }
+        NetDeviceContainer devices = p2p.Install(nodes.Get(link.nodeA), nodes.Get(link.nodeB));
+        Ipv4InterfaceContainer interfaces = addressHelpers[link.subnet].Assign(devices);
+        for (uint32_t side = 0; side < 2; ++side) {
+            linkDevices[2 * i + side] = devices.Get(side);
+            linkAddresses[2 * i + side] = interfaces.GetAddress(side);
+            uint32_t id = side == 0 ? link.nodeA : link.nodeB;
+            addressNode[linkAddresses[2 * i + side].Get()] = id;
+            if (nodeFirstLink[id] == 0xffffffff) {
+                nodeFirstLink[id] = 2 * i + side;
+            }
+        }
+    }
+
+    m_prefixes.clear();
+    for (uint32_t d = 0; d < departments.size(); ++d) {
+        const TopologySubnet& subnet = m_subnets[departments[d].subnet];
+        uint32_t network = subnet.network.CombineMask(subnet.mask).Get();
+        DepartmentPrefix prefix = { network, network | ~subnet.mask.Get(), d };
+        m_prefixes.push_back(prefix);
+    }
+    std::sort(m_prefixes.begin(), m_prefixes.end(), [](const DepartmentPrefix& a, const DepartmentPrefix& b) {
+        return a.first < b.first;
+    });
+    for (size_t i = 1; i < m_prefixes.size(); ++i) {
+        NS_ABORT_MSG_IF(m_prefixes[i].first <= m_prefixes[i - 1].last, "Departments " << departments[m_prefixes[i - 1].department].name
+                        << " and " << departments[m_prefixes[i].department].name << " have overlapping subnets");
+    }
+
+    setupTimeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    NS_LOG_INFO("Topology built: " << nodeInfo.size() << " nodes, " << links.size()
+                << " links in " << setupTimeMs << " ms");
+}
+
+Ipv4Address CampusTopology::GetNodeAddress(uint32_t id) const {
+    NS_ABORT_MSG_IF(id >= nodeFirstLink.size() || nodeFirstLink[id] == 0xffffffff, "Node " << id << " has no link");
+    return linkAddresses[nodeFirstLink[id]];
+}
+
+void CampusTopology::Partition(uint32_t ranks) {
+    for (uint32_t id = 0; id < nodeInfo.size(); ++id) {
+        TopologyNode& node = nodeInfo[id];
+        node.systemId = node.department == kNoDepartment ? 0 : node.department * ranks / departments.size();
+    }
+    for (uint32_t c = 0; c < cores.size(); ++c) {
+        nodeInfo[cores[c]].systemId = c * ranks / cores.size();
+    }
+    for (size_t i = 0; i < links.size(); ++i) {
+        const TopologyLink& link = links[i];
+        NS_ABORT_MSG_IF(nodeInfo[link.nodeA].systemId != nodeInfo[link.nodeB].systemId
+                        && Time(m_profiles[link.profile].delay).IsZero(),
+                        "Link " << link.nodeA << "-" << link.nodeB << " crosses ranks with zero delay");
+    }
+}
+
+Ptr<NetDevice> CampusTopology::GetNodeDevice(uint32_t id) const {
+    NS_ABORT_MSG_IF(id >= nodeFirstLink.size() || nodeFirstLink[id] == 0xffffffff, "Node " << id << " has no link");
+    return linkDevices[nodeFirstLink[id]];
+}
+
+uint32_t CampusTopology::GetDepartmentOfAddress(Ipv4Address address) const {
+    std::unordered_map<uint32_t, uint32_t>::const_iterator it = addressNode.find(address.Get());
+    return it == addressNode.end() ? kNoDepartment : nodeInfo[it->second].department;
+}
+
+void CampusTopology::ApplyAnimationLayout(AnimationInterface& anim) const {
+    for (uint32_t id = 0; id < nodeInfo.size(); ++id) {
+        anim.SetConstantPosition(nodes.Get(id), nodeInfo[id].x, nodeInfo[id].y);
+        if (!nodeInfo[id].description.empty()) {
+            anim.UpdateNodeDescription(nodes.Get(id), nodeInfo[id].description);
+        }
+    }
+}
+
+uint32_t CampusTopology::FindDepartment(Ipv4Address address) const {
+    uint32_t value = address.Get();
+    std::vector<DepartmentPrefix>::const_iterator it = std::upper_bound(m_prefixes.begin(), m_prefixes.end(), value,
+        [](uint32_t v, const DepartmentPrefix& prefix) { return v < prefix.first; });
+    if (it != m_prefixes.begin() && value <= (it - 1)->last) {
+        return (it - 1)->department;
+    }
+    return GetDepartmentOfAddress(address);
+}
+
+
+// Per-packet streaming statistics
+//
+// Every locally originated IPv4 packet is tagged with its send time; on local
+// delivery the one-way delay feeds per-flow and per-department accumulators whose
+// size does not depend on the number of packets. The accumulators themselves
+// are in campus_statistics.h.
+
+class PacketTimestampTag : public Tag {
+public:
+    static TypeId GetTypeId(void);
+    virtual TypeId GetInstanceTypeId(void) const;
+    virtual uint32_t GetSerializedSize(void) const;
+    virtual void Serialize(TagBuffer i) const;
+    virtual void Deserialize(TagBuffer i);
+    virtual void Print(std::ostream& os) const;
+
+    void SetTimestamp(Time time) { m_timestamp = time.GetTimeStep(); }
+    Time GetTimestamp(void) const { return TimeStep(m_timestamp); }
+
+private:
+    int64_t m_timestamp;
+};
+
+TypeId PacketTimestampTag::GetTypeId(void) {
+    static TypeId tid = TypeId("PacketTimestampTag")
+        .SetParent<Tag>()
+        .AddConstructor<PacketTimestampTag>();
+    return tid;
+}
+NS_OBJECT_ENSURE_REGISTERED(PacketTimestampTag);
+
+TypeId PacketTimestampTag::GetInstanceTypeId(void) const {
+    return GetTypeId();
+}
+
+uint32_t PacketTimestampTag::GetSerializedSize(void) const {
+    return 8;
+}
+
+void PacketTimestampTag::Serialize(TagBuffer i) const {
+    i.WriteU64(m_timestamp);
+}
+
+void PacketTimestampTag::Deserialize(TagBuffer i) {
+    m_timestamp = i.ReadU64();
+}
+
+void PacketTimestampTag::Print(std::ostream& os) const {
+    os << "t=" << m_timestamp;
+}
+
+struct FlowKey {
+    uint32_t source;
+    uint32_t destination;
+    uint16_t sourcePort;
+    uint16_t destinationPort;
+    uint8_t protocol;
+
+    bool operator==(const FlowKey& other) const {
+        return source == other.source && destination == other.destination && sourcePort == other.sourcePort
+            && destinationPort == other.destinationPort && protocol == other.protocol;
+    }
+
+    bool operator<(const FlowKey& other) const {
+        if (source != other.source) {
+            return source < other.source;
+        }
+        if (destination != other.destination) {
+            return destination < other.destination;
+        }
+        if (sourcePort != other.sourcePort) {
+            return sourcePort < other.sourcePort;
+        }
+        return destinationPort != other.destinationPort ? destinationPort < other.destinationPort
+                                                         : protocol < other.protocol;
+    }
+};
+
+struct FlowKeyHash {
+    size_t operator()(const FlowKey& key) const {
+        uint64_t h = ((uint64_t)key.source << 32) ^ key.destination;
+        h ^= ((uint64_t)key.sourcePort << 24) ^ ((uint64_t)key.destinationPort << 8) ^ key.protocol;
+        h *= 0x9e3779b97f4a7c15ull;
+        return h ^ (h >> 29);
+    }
+};
+
+// Addresses, protocol and, for TCP and UDP, ports of a packet whose IP header was removed;
+// ports stay 0 without a packet or one too short to hold the transport header
+static FlowKey MakeFlowKey(const Ipv4Header& header, Ptr<const Packet> packet) {
+    FlowKey key = { header.GetSource().Get(), header.GetDestination().Get(), 0, 0, header.GetProtocol() };
+    if (!packet || packet->GetSize() < (key.protocol == 6 ? 20u : 8u)) {
+        return key;
+    }
+    if (key.protocol == 6) {
+        TcpHeader tcp;
+        packet->PeekHeader(tcp);
+        key.sourcePort = tcp.GetSourcePort();
+        key.destinationPort = tcp.GetDestinationPort();
+    } else if (key.protocol == 17) {
+        UdpHeader udp;
+        packet->PeekHeader(udp);
+        key.sourcePort = udp.GetSourcePort();
+        key.destinationPort = udp.GetDestinationPort();
+    }
+    return key;
+}
+
+// Key of an IPv4 packet queued on a point-to-point device, behind its PPP header;
+// false for other protocols
+static bool MakeFrameFlowKey(Ptr<const Packet> frame, FlowKey& key) {
+    Ptr<Packet> packet = frame->Copy();
+    PppHeader ppp;
+    packet->RemoveHeader(ppp);
+    if (ppp.GetProtocol() != 0x0021) {     // not IPv4
+        return false;
+    }
+    Ipv4Header header;
+    packet->RemoveHeader(header);
+    key = MakeFlowKey(header, packet);
+    return true;
+}
+
+// Root queue disc of a device, null when traffic control installed none
+static Ptr<QueueDisc> GetDeviceQueueDisc(Ptr<NetDevice> device) {
+    Ptr<TrafficControlLayer> tc = device->GetNode()->GetObject<TrafficControlLayer>();
+    return tc ? tc->GetRootQueueDiscOnDevice(device) : Ptr<QueueDisc>();
+}
+
+// Counters of one flow, wherever its packets were sent, forwarded, dropped or delivered
+struct FlowTotals {
+    uint64_t txPackets;
+    uint64_t txBytes;
+    uint64_t rxPackets;
+    uint64_t rxBytes;
+    uint64_t lostPackets;       // dropped by IP, a device queue or a queue disc
+    uint64_t timesForwarded;
+    double delaySum;            // seconds, over the received packets
+    double firstTx;             // seconds, infinity before the first transmission
+    double lastRx;              // seconds, 0 before the first reception
+};
+
+// Traffic a flow delivered since the previous window was collected
+struct FlowWindowSample {
+    uint32_t flow;
+    uint32_t packets;
+    uint64_t bytes;
+    double delaySum;
+};
+
+class PacketStatsCollector {
+public:
+    PacketStatsCollector(const CampusTopology& topology);
+
+    // Hooks the Ipv4L3Protocol send, forward, drop and local-delivery traces of every node and the
+    // drop traces of the link device queues and queue discs
+    void Install(void);
+    // Adds every rank's flow totals into the root's, flow by flow; delay distributions stay on the
+    // rank that received the packets
+    void MergeAcrossRanks(uint32_t root);
+    // Indexed by source department; traffic from cores lands in the last entry
+    const std::vector<StreamingDelayStats>& GetDepartmentStats(void) const { return m_departments; }
+
+    uint32_t GetNFlows(void) const { return m_keys.size(); }
+    const FlowKey& GetFlowKey(uint32_t flow) const { return m_keys[flow]; }
+    const StreamingDelayStats& GetFlowStats(uint32_t flow) const { return m_flows[flow]; }
+    const FlowTotals& GetFlowTotals(uint32_t flow) const { return m_totals[flow]; }
+    // Flow indices sorted by key, the same on every rank count
+    std::vector<uint32_t> GetFlowsInKeyOrder(void) const;
+    // Starts per-window accounting for CollectWindow
+    void EnableWindows(void) { m_windowsEnabled = true; }
+    // Moves the flows that delivered packets since the last call into samples
+    void CollectWindow(std::vector<FlowWindowSample>& samples);
+    // Called with the flow, delay and size of every timed delivery
+    void AddDeliveryCallback(Callback<void, const FlowKey&, Time, uint32_t> callback) {
+        m_deliveryCallbacks.push_back(callback);
+    }
+
+private:
+    void PacketSent(const Ipv4Header& header, Ptr<const Packet> packet, uint32_t interface);
+    void PacketDelivered(const Ipv4Header& header, Ptr<const Packet> packet, uint32_t interface);
+    void PacketForwarded(const Ipv4Header& header, Ptr<const Packet> packet, uint32_t interface);
+    void PacketDropped(const Ipv4Header& header, Ptr<const Packet> packet, Ipv4L3Protocol::DropReason reason,
+                       Ptr<Ipv4> ipv4, uint32_t interface);
+    void DeviceQueueDropped(Ptr<const Packet> frame);
+    void DiscDropped(Ptr<const QueueDiscItem> item);
+    // Index of a flow, created on first sight
+    uint32_t GetFlow(const FlowKey& key);
+
+    const CampusTopology& m_topology;
+    std::unordered_map<FlowKey, uint32_t, FlowKeyHash> m_flowIndex;
+    std::vector<StreamingDelayStats> m_flows;
+    std::vector<FlowKey> m_keys;
+    std::vector<FlowTotals> m_totals;
+    std::vector<StreamingDelayStats> m_departments;
+    bool m_windowsEnabled;
+    std::vector<FlowWindowSample> m_windows;   // per flow, packets == 0 when idle
+    std::vector<uint32_t> m_dirtyFlows;
+    std::vector<Callback<void, const FlowKey&, Time, uint32_t> > m_deliveryCallbacks;
+};
+
+PacketStatsCollector::PacketStatsCollector(const CampusTopology& topology)
+    : m_topology(topology), m_departments(topology.departments.size() + 1), m_windowsEnabled(false) {}
+
+void PacketStatsCollector::Install(void) {
+    Config::ConnectWithoutContext("/NodeList/*/$ns3::Ipv4L3Protocol/SendOutgoing",
+                                  MakeCallback(&PacketStatsCollector::PacketSent, this));
+    Config::ConnectWithoutContext("/NodeList/*/$ns3::Ipv4L3Protocol/LocalDeliver",
+                                  MakeCallback(&PacketStatsCollector::PacketDelivered, this));
+    Config::ConnectWithoutContext("/NodeList/*/$ns3::Ipv4L3Protocol/UnicastForward",
+                                  MakeCallback(&PacketStatsCollector::PacketForwarded, this));
+    Config::ConnectWithoutContext("/NodeList/*/$ns3::Ipv4L3Protocol/Drop",
+                                  MakeCallback(&PacketStatsCollector::PacketDropped, this));
+    for (uint32_t i = 0; i < m_topology.linkDevices.size(); ++i) {
+        Ptr<PointToPointNetDevice> p2p = DynamicCast<PointToPointNetDevice>(m_topology.linkDevices[i]);
+        if (p2p) {
+            p2p->GetQueue()->TraceConnectWithoutContext("Drop",
+                MakeCallback(&PacketStatsCollector::DeviceQueueDropped, this));
+        }
+        Ptr<QueueDisc> disc = GetDeviceQueueDisc(m_topology.linkDevices[i]);
+        if (disc) {
+            disc->TraceConnectWithoutContext("Drop", MakeCallback(&PacketStatsCollector::DiscDropped, this));
+        }
+    }
+}
+
+uint32_t PacketStatsCollector::GetFlow(const FlowKey& key) {
+    std::pair<std::unordered_map<FlowKey, uint32_t, FlowKeyHash>::iterator, bool> slot =
+        m_flowIndex.insert(std::make_pair(key, (uint32_t)m_flows.size()));
+    uint32_t flow = slot.first->second;
+    if (slot.second) {
+        m_flows.push_back(StreamingDelayStats());
+        m_keys.push_back(key);
+        FlowTotals none = { 0, 0, 0, 0, 0, 0, 0.0, std::numeric_limits<double>::infinity(), 0.0 };
+        m_totals.push_back(none);
+        FlowWindowSample idle = { flow, 0, 0, 0.0 };
+        m_windows.push_back(idle);
+    }
+    return flow;
+}
+
+void PacketStatsCollector::PacketSent(const Ipv4Header& header, Ptr<const Packet> packet, uint32_t) {
+    PacketTimestampTag tag;
+    tag.SetTimestamp(Simulator::Now());
+    packet->AddPacketTag(tag);
+    FlowTotals& totals = m_totals[GetFlow(MakeFlowKey(header, packet))];
+    totals.txPackets++;
+    totals.txBytes += packet->GetSize();
+    totals.firstTx = std::min(totals.firstTx, Simulator::Now().GetSeconds());
+}
+
+void PacketStatsCollector::PacketForwarded(const Ipv4Header& header, Ptr<const Packet> packet, uint32_t) {
+    m_totals[GetFlow(MakeFlowKey(header, packet))].timesForwarded++;
+}
+
+// Only timed packets count, the ones whose transmission was counted
+void PacketStatsCollector::PacketDropped(const Ipv4Header& header, Ptr<const Packet> packet,
+                                         Ipv4L3Protocol::DropReason, Ptr<Ipv4>, uint32_t) {
+    PacketTimestampTag tag;
+    if (packet->PeekPacketTag(tag)) {
+        m_totals[GetFlow(MakeFlowKey(header, packet))].lostPackets++;
+    }
+}
+
+void PacketStatsCollector::DeviceQueueDropped(Ptr<const Packet> frame) {
+    PacketTimestampTag tag;
+    FlowKey key;
+    if (frame->PeekPacketTag(tag) && MakeFrameFlowKey(frame, key)) {
+        m_totals[GetFlow(key)].lostPackets++;
+    }
+}
+
+void PacketStatsCollector::DiscDropped(Ptr<const QueueDiscItem> item) {
+    Ptr<const Ipv4QueueDiscItem> ipv4 = DynamicCast<const Ipv4QueueDiscItem>(item);
+    PacketTimestampTag tag;
+    if (ipv4 && ipv4->GetPacket()->PeekPacketTag(tag)) {
+        m_totals[GetFlow(MakeFlowKey(ipv4->GetHeader(), ipv4->GetPacket()))].lostPackets++;
+    }
+}
+
+void PacketStatsCollector::PacketDelivered(const Ipv4Header& header, Ptr<const Packet> packet, uint32_t) {
+    PacketTimestampTag tag;
+    if (!ConstCast<Packet>(packet)->RemovePacketTag(tag)) {
+        return;
+    }
+    Time delay = Simulator::Now() - tag.GetTimestamp();
+
+    FlowKey key = MakeFlowKey(header, packet);
+    uint32_t flow = GetFlow(key);
+    m_flows[flow].Add(delay, packet->GetSize());
+    FlowTotals& totals = m_totals[flow];
+    totals.rxPackets++;
+    totals.rxBytes += packet->GetSize();
+    totals.delaySum += delay.GetSeconds();
+    totals.lastRx = Simulator::Now().GetSeconds();
+    for (size_t c = 0; c < m_deliveryCallbacks.size(); ++c) {
+        m_deliveryCallbacks[c](key, delay, packet->GetSize());
+    }
+
+    if (m_windowsEnabled) {
+        FlowWindowSample& window = m_windows[flow];
+        if (window.packets == 0) {
+            m_dirtyFlows.push_back(flow);
+        }
+        window.packets++;
+        window.bytes += packet->GetSize();
+        window.delaySum += delay.GetSeconds();
+    }
+
+    uint32_t department = m_topology.GetDepartmentOfAddress(header.GetSource());
+    m_departments[department == kNoDepartment ? m_departments.size() - 1 : department].Add(delay, packet->GetSize());
+}
+
+void PacketStatsCollector::CollectWindow(std::vector<FlowWindowSample>& samples) {
+    samples.clear();
+    for (size_t i = 0; i < m_dirtyFlows.size(); ++i) {
+        FlowWindowSample& window = m_windows[m_dirtyFlows[i]];
+        samples.push_back(window);
+        window.packets = 0;
+        window.bytes = 0;
+        window.delaySum = 0.0;
+    }
+    m_dirtyFlows.clear();
+}
+
+std::vector<uint32_t> PacketStatsCollector::GetFlowsInKeyOrder(void) const {
+    std::vector<uint32_t> order(m_keys.size());
+    for (uint32_t f = 0; f < order.size(); ++f) {
+        order[f] = f;
+    }
+    std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return m_keys[a] < m_keys[b]; });
+    return order;
+}
+
+
+// Distributed execution
+//
+// With --distributed every MPI rank builds the whole topology, simulates the
+// nodes Partition assigned to it and runs the applications installed there.
+// The rank owning the server merges the other ranks' accumulators and reports.
+// Accumulators cross ranks field by field, never as raw object bytes.
+//
+// Flow Monitor cannot follow packets between ranks, so sequential and
+// distributed runs alike take their flow counters from the packet tags: each
+// rank counts the transmissions, forwards and drops of timed packets where they
+// happen, and the reporting rank adds them up flow by flow. Flows are reported in
+// key order, so a distributed run's summary matches the sequential run's for the
+// same seed; check_distributed.sh compares the two on the default campus. Early
+// stopping (--precision), edge caches (--cache) and the traffic-matrix workload
+// still need every rank's state at once and are refused.
+
+static uint32_t LocalRank(void) {
+#ifdef NS3_MPI
+    if (MpiInterface::IsEnabled()) {
+        return MpiInterface::GetSystemId();
+    }
+#endif
+    return 0;
+}
+
+static uint32_t RankCount(void) {
+#ifdef NS3_MPI
+    if (MpiInterface::IsEnabled()) {
+        return MpiInterface::GetSize();
+    }
+#endif
+    return 1;
+}
+
+// Per-rank artifact names, so ranks never write the same file
+static std::string RankFileName(const std::string& filename) {
+    if (RankCount() == 1) {
+        return filename;
+    }
+    std::ostringstream name;
+    name << filename << ".rank" << LocalRank();
+    return name.str();
+}
+
+// Folds every rank's copy of each accumulator into the root's, entry by entry
+static void MergeAcrossRanks(std::vector<StreamingDelayStats>& stats, uint32_t root) {
+#ifdef NS3_MPI
+    uint32_t ranks = RankCount();
+    if (ranks == 1 || stats.empty()) {
+        return;
+    }
+    const uint32_t realCount = StreamingDelayStats::kPackedReals;
+    const uint32_t wordCount = StreamingDelayStats::kPackedWords;
+    std::vector<double> reals(stats.size() * realCount);
+    std::vector<uint64_t> words(stats.size() * wordCount);
+    for (size_t i = 0; i < stats.size(); ++i) {
+        stats[i].Pack(&reals[i * realCount], &words[i * wordCount]);
+    }
+    bool isRoot = LocalRank() == root;
+    std::vector<double> allReals(isRoot ? reals.size() * ranks : 0);
+    std::vector<uint64_t> allWords(isRoot ? words.size() * ranks : 0);
+    MPI_Gather(&reals[0], reals.size(), MPI_DOUBLE, isRoot ? &allReals[0] : 0, reals.size(), MPI_DOUBLE, root, MPI_COMM_WORLD);
+    MPI_Gather(&words[0], words.size(), MPI_UINT64_T, isRoot ? &allWords[0] : 0, words.size(), MPI_UINT64_T, root, MPI_COMM_WORLD);
+    if (isRoot) {
+        StreamingDelayStats other;
+        for (uint32_t r = 0; r < ranks; ++r) {
+            for (size_t i = 0; r != root && i < stats.size(); ++i) {
+                size_t entry = r * stats.size() + i;
+                other.Unpack(&allReals[entry * realCount], &allWords[entry * wordCount]);
+                stats[i].Merge(other);
+            }
+        }
+    }
+#else
+    (void)stats;
+    (void)root;
+#endif
+}
+
+void PacketStatsCollector::MergeAcrossRanks(uint32_t root) {
+#ifdef NS3_MPI
+    uint32_t ranks = RankCount();
+    if (ranks == 1) {
+        return;
+    }
+    // Per flow: the key in four words, then the counters; times as reals
+    const uint32_t wordCount = 10, realCount = 3;
+    std::vector<uint64_t> words(m_keys.size() * wordCount);
+    std::vector<double> reals(m_keys.size() * realCount);
+    for (size_t f = 0; f < m_keys.size(); ++f) {
+        const FlowKey& key = m_keys[f];
+        const FlowTotals& totals = m_totals[f];
+        uint64_t *w = &words[f * wordCount];
+        w[0] = key.source;
+        w[1] = key.destination;
+        w[2] = ((uint64_t)key.sourcePort << 16) | key.destinationPort;
+        w[3] = key.protocol;
+        w[4] = totals.txPackets;
+        w[5] = totals.txBytes;
+        w[6] = totals.rxPackets;
+        w[7] = totals.rxBytes;
+        w[8] = totals.lostPackets;
+        w[9] = totals.timesForwarded;
+        reals[f * realCount] = totals.delaySum;
+        reals[f * realCount + 1] = totals.firstTx;
+        reals[f * realCount + 2] = totals.lastRx;
+    }
+    // Ranks know different flows, so the root first learns how many each sends
+    bool isRoot = LocalRank() == root;
+    int flows = m_keys.size();
+    std::vector<int> counts(isRoot ? ranks : 0);
+    MPI_Gather(&flows, 1, MPI_INT, isRoot ? &counts[0] : 0, 1, MPI_INT, root, MPI_COMM_WORLD);
+    std::vector<int> wordCounts(counts.size()), wordOffsets(counts.size());
+    std::vector<int> realCounts(counts.size()), realOffsets(counts.size());
+    int totalFlows = 0;
+    for (size_t r = 0; r < counts.size(); ++r) {
+        wordCounts[r] = counts[r] * wordCount;
+        wordOffsets[r] = totalFlows * wordCount;
+        realCounts[r] = counts[r] * realCount;
+        realOffsets[r] = totalFlows * realCount;
+        totalFlows += counts[r];
+    }
+    std::vector<uint64_t> allWords(std::max(1, totalFlows) * wordCount);
+    std::vector<double> allReals(std::max(1, totalFlows) * realCount);
+    MPI_Gatherv(words.empty() ? 0 : &words[0], words.size(), MPI_UINT64_T, &allWords[0],
+                isRoot ? &wordCounts[0] : 0, isRoot ? &wordOffsets[0] : 0, MPI_UINT64_T, root, MPI_COMM_WORLD);
+    MPI_Gatherv(reals.empty() ? 0 : &reals[0], reals.size(), MPI_DOUBLE, &allReals[0],
+                isRoot ? &realCounts[0] : 0, isRoot ? &realOffsets[0] : 0, MPI_DOUBLE, root, MPI_COMM_WORLD);
+    if (!isRoot) {
+        return;
+    }
+    for (uint32_t r = 0; r < ranks; ++r) {
+        for (int i = 0; r != root && i < counts[r]; ++i) {
+            size_t entry = wordOffsets[r] / wordCount + i;
+            const uint64_t *w = &allWords[entry * wordCount];
+            const double *real = &allReals[entry * realCount];
+            FlowKey key = { (uint32_t)w[0], (uint32_t)w[1], (uint16_t)(w[2] >> 16), (uint16_t)w[2], (uint8_t)w[3] };
+            FlowTotals& totals = m_totals[GetFlow(key)];
+            totals.txPackets += w[4];
+            totals.txBytes += w[5];
+            totals.rxPackets += w[6];
+            totals.rxBytes += w[7];
+            totals.lostPackets += w[8];
+            totals.timesForwarded += w[9];
+            totals.delaySum += real[0];
+            totals.firstTx = std::min(totals.firstTx, real[1]);
+            totals.lastRx = std::max(totals.lastRx, real[2]);
+        }
+    }
+#else
+    (void)root;
+#endif
+}
+
+
+// Route repair
+//
+// Failures never touch global routing's tables. Instead RouteRepair keeps the
+// link state the routers have converged on and, while any link is down, answers
+// next-hop queries from shortest paths over the live links: one BFS per
+// destination node that carries traffic, cached until the state changes again.
+
+static const uint32_t kNoNode = 0xffffffff;
+
+class RouteRepair {
+public:
+    RouteRepair(const CampusTopology& topology);
+
+    // Counts a failure of the link starting (up = false) or ending (up = true)
+    void SetLinkState(uint32_t link, bool up);
+    // Makes the routers act on the current link state
+    void Converge(void);
+    bool IsLinkFailed(uint32_t link) const { return m_failures[link] > 0; }
+    // True while the converged state has failed links
+    bool IsActive(void) const { return m_convergedDown > 0; }
+
+    uint32_t NodeOfAddress(Ipv4Address address) const;
+    Ptr<NetDevice> GetDevice(uint32_t device) const { return m_topology.linkDevices[device]; }
+    // Address of the far end of a device's link
+    Ipv4Address GetPeerAddress(uint32_t device) const { return m_topology.linkAddresses[device ^ 1]; }
+    // Devices (2*link+side) of node on a shortest live path to destination
+    const std::vector<uint32_t>& NextHops(uint32_t node, uint32_t destination);
+
+private:
+    const CampusTopology& m_topology;
+    std::vector<std::vector<uint32_t> > m_nodeDevices;
+    std::vector<uint32_t> m_failures;           // per link, overlapping failures
+    std::vector<bool> m_convergedUp;            // per link, as the routers see it
+    uint32_t m_convergedDown;
+    std::unordered_map<uint32_t, std::vector<uint32_t> > m_distances;
+    std::vector<uint32_t> m_hops;
+    std::deque<uint32_t> m_frontier;
+};
+
+RouteRepair::RouteRepair(const CampusTopology& topology)
+    : m_topology(topology), m_nodeDevices(topology.GetNNodes()), m_failures(topology.GetNLinks(), 0),
+      m_convergedUp(topology.GetNLinks(), true), m_convergedDown(0) {
+    for (uint32_t i = 0; i < topology.GetNLinks(); ++i) {
+        m_nodeDevices[topology.links[i].nodeA].push_back(2 * i);
+        m_nodeDevices[topology.links[i].nodeB].push_back(2 * i + 1);
+    }
+}
+
+void RouteRepair::SetLinkState(uint32_t link, bool up) {
+    NS_ASSERT(!up || m_failures[link] > 0);
+    if (up) {
+        m_failures[link]--;
+    } else {
+        m_failures[link]++;
+    }
+}
+
+void RouteRepair::Converge(void) {
+    m_convergedDown = 0;
+    for (uint32_t i = 0; i < m_failures.size(); ++i) {
+        m_convergedUp[i] = m_failures[i] == 0;
+        m_convergedDown += m_convergedUp[i] ? 0 : 1;
+    }
+    m_distances.clear();
+}
+
+uint32_t RouteRepair::NodeOfAddress(Ipv4Address address) const {
+    std::unordered_map<uint32_t, uint32_t>::const_iterator it = m_topology.addressNode.find(address.Get());
+    return it == m_topology.addressNode.end() ? kNoNode : it->second;
+}
+
+const std::vector<uint32_t>& RouteRepair::NextHops(uint32_t node, uint32_t destination) {
+    std::pair<std::unordered_map<uint32_t, std::vector<uint32_t> >::iterator, bool> slot =
+        m_distances.insert(std::make_pair(destination, std::vector<uint32_t>()));
+    std::vector<uint32_t>& distance = slot.first->second;
+    if (slot.second) {
+        distance.assign(m_nodeDevices.size(), kNoNode);
+        distance[destination] = 0;
+        m_frontier.assign(1, destination);
+        while (!m_frontier.empty()) {
+            uint32_t current = m_frontier.front();
+            m_frontier.pop_front();
+            for (size_t d = 0; d < m_nodeDevices[current].size(); ++d) {
+                uint32_t device = m_nodeDevices[current][d];
+                const TopologyLink& link = m_topology.links[device / 2];
+                uint32_t neighbor = device % 2 == 0 ? link.nodeB : link.nodeA;
+                if (m_convergedUp[device / 2] && distance[neighbor] == kNoNode) {
+                    distance[neighbor] = distance[current] + 1;
+                    m_frontier.push_back(neighbor);
+                }
+            }
+        }
+    }
+
+    m_hops.clear();
+    for (size_t d = 0; distance[node] != kNoNode && d < m_nodeDevices[node].size(); ++d) {
+        uint32_t device = m_nodeDevices[node][d];
+        const TopologyLink& link = m_topology.links[device / 2];
+        uint32_t neighbor = device % 2 == 0 ? link.nodeB : link.nodeA;
+        if (m_convergedUp[device / 2] && distance[neighbor] + 1 == distance[node]) {
+            m_hops.push_back(device);
+        }
+    }
+    return m_hops;
+}
+
+
+// Equal-cost multipath routing
+//
+// Global routing keeps every equal-cost route but always forwards on the first.
+// EcmpRouting sits above it in each node's list routing and spreads forwarded
+// packets that have several equal-cost next hops: per flow, by 5-tuple hash, or
+// per flowlet, where a burst that follows a gap longer than flowletGap may move
+// to another path without reordering the flow. Locally originated packets, such
+// as an edge cache's origin fetches, are spread the same way; UDP ports are not
+// on the packet yet at that point, so local UDP hashes on addresses alone.
+// Destinations with a single route fall through to global routing. While route
+// repair is active after a failure, forwarding and local output follow its live
+// shortest paths instead, with the same choice among equal-cost next hops.
+
+class EcmpRouting : public Ipv4RoutingProtocol {
+public:
+    static TypeId GetTypeId(void);
+    EcmpRouting();
+
+    // Puts an EcmpRouting above global routing on every node
+    static void Install(NodeContainer nodes, EcmpMode mode, Time flowletGap, RouteRepair *repair = 0);
+
+    // Cached routes point into global routing's table; flush after recomputing it
+    void FlushCache(void) { m_candidates.clear(); }
+
+    virtual Ptr<Ipv4Route> RouteOutput(Ptr<Packet> p, const Ipv4Header& header, Ptr<NetDevice> oif, Socket::SocketErrno& sockerr);
+    virtual bool RouteInput(Ptr<const Packet> p, const Ipv4Header& header, Ptr<const NetDevice> idev,
+                            UnicastForwardCallback ucb, MulticastForwardCallback mcb,
+                            LocalDeliverCallback lcb, ErrorCallback ecb);
+    virtual void NotifyInterfaceUp(uint32_t) { FlushCache(); }
+    virtual void NotifyInterfaceDown(uint32_t) { FlushCache(); }
+    virtual void NotifyAddAddress(uint32_t, Ipv4InterfaceAddress) { FlushCache(); }
+    virtual void NotifyRemoveAddress(uint32_t, Ipv4InterfaceAddress) { FlushCache(); }
+    virtual void SetIpv4(Ptr<Ipv4> ipv4) { m_ipv4 = ipv4; }
+    virtual void PrintRoutingTable(Ptr<OutputStreamWrapper> stream, Time::Unit unit = Time::S) const;
+
+private:
+    // A flowlet's path hashes on its start time, so an entry idle past the gap
+    // carries nothing a new flowlet needs and can be dropped
+    struct Flowlet {
+        Time start;
+        Time last;
+    };
+
+    // Longest-prefix routes of global routing for a destination, in table order
+    const std::vector<Ipv4RoutingTableEntry *>& Candidates(Ipv4Address destination);
+    // Index of the path the packet's flow (or flowlet) takes among n
+    uint32_t ChoosePath(const Ipv4Header& header, Ptr<const Packet> p, uint32_t n);
+    // Route over one of several equal-cost global routes, null for a single route
+    Ptr<Ipv4Route> EqualCostRoute(const Ipv4Header& header, Ptr<const Packet> p, bool local);
+    // Route out of interface towards gateway; local packets keep the source their socket chose
+    Ptr<Ipv4Route> MakeRoute(const Ipv4Header& header, uint32_t interface, Ipv4Address gateway, bool local) const;
+    // Route along route repair's live shortest paths; null with unreachable set when none is left,
+    // null alone when the destination is unknown or this node
+    Ptr<Ipv4Route> RepairedRoute(const Ipv4Header& header, Ptr<const Packet> p, bool local, bool& unreachable);
+
+    Ptr<Ipv4> m_ipv4;
+    Ptr<Ipv4GlobalRouting> m_global;
+    EcmpMode m_mode;
+    Time m_flowletGap;
+    uint64_t m_salt;                // per node, so switches in series hash independently
+    std::unordered_map<uint32_t, std::vector<Ipv4RoutingTableEntry *> > m_candidates;
+    std::vector<Ipv4RoutingTableEntry *> m_up;
+    std::unordered_map<uint64_t, Flowlet> m_flowlets;
+    size_t m_flowletSweep;          // table size at which idle flowlets are next dropped
+    RouteRepair *m_repair;
+    uint32_t m_node;
+};
+
+TypeId EcmpRouting::GetTypeId(void) {
+    static TypeId tid = TypeId("EcmpRouting")
+        .SetParent<Ipv4RoutingProtocol>()
+        .AddConstructor<EcmpRouting>();
+    return tid;
+}
+NS_OBJECT_ENSURE_REGISTERED(EcmpRouting);
+
+EcmpRouting::EcmpRouting() : m_mode(ECMP_FLOW), m_salt(0), m_flowletSweep(64), m_repair(0), m_node(0) {}
+
+// splitmix64 finalizer
+static uint64_t MixHash(uint64_t h) {
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    return h ^ (h >> 31);
+}
+
+void EcmpRouting::Install(NodeContainer nodes, EcmpMode mode, Time flowletGap, RouteRepair *repair) {
+    for (uint32_t n = 0; n < nodes.GetN(); ++n) {
+        Ptr<Ipv4> ipv4 = nodes.Get(n)->GetObject<Ipv4>();
+        Ptr<Ipv4ListRouting> list = DynamicCast<Ipv4ListRouting>(ipv4->GetRoutingProtocol());
+        NS_ABORT_MSG_IF(!list, "Node " << n << " has no list routing");
+        Ptr<Ipv4GlobalRouting> global;
+        for (uint32_t i = 0; !global && i < list->GetNRoutingProtocols(); ++i) {
+            int16_t priority;
+            global = DynamicCast<Ipv4GlobalRouting>(list->GetRoutingProtocol(i, priority));
+        }
+        NS_ABORT_MSG_IF(!global, "Node " << n << " has no global routing");
+
+        Ptr<EcmpRouting> ecmp = CreateObject<EcmpRouting>();
+        ecmp->m_global = global;
+        ecmp->m_mode = mode;
+        ecmp->m_flowletGap = flowletGap;
+        ecmp->m_salt = MixHash(nodes.Get(n)->GetId() + 1);
+        ecmp->m_repair = repair;
+        ecmp->m_node = nodes.Get(n)->GetId();
+        list->AddRoutingProtocol(ecmp, 10);
+    }
+}
+
+const std::vector<Ipv4RoutingTableEntry *>& EcmpRouting::Candidates(Ipv4Address destination) {
+    std::pair<std::unordered_map<uint32_t, std::vector<Ipv4RoutingTableEntry *> >::iterator, bool> slot =
+        m_candidates.insert(std::make_pair(destination.Get(), std::vector<Ipv4RoutingTableEntry *>()));
+    std::vector<Ipv4RoutingTableEntry *>& routes = slot.first->second;
+    if (!slot.second) {
+        return routes;
+    }
+    int best = -1;
+    for (uint32_t i = 0; i < m_global->GetNRoutes(); ++i) {
+        Ipv4RoutingTableEntry *route = m_global->GetRoute(i);
+        int prefix;
+        if (route->IsHost()) {
+            prefix = route->GetDest() == destination ? 32 : -1;
+        } else {
+            Ipv4Mask mask = route->GetDestNetworkMask();
+            prefix = mask.IsMatch(destination, route->GetDestNetwork()) ? mask.GetPrefixLength() : -1;
+        }
+        if (prefix > best) {
+            best = prefix;
+            routes.clear();
+        }
+        if (prefix == best && prefix >= 0) {
+            routes.push_back(route);
+        }
+    }
+    return routes;
+}
+
+Ptr<Ipv4Route> EcmpRouting::RouteOutput(Ptr<Packet> p, const Ipv4Header& header, Ptr<NetDevice> oif, Socket::SocketErrno& sockerr) {
+    // Returning no route hands the packet to global routing: for sockets bound to a
+    // device, multicast and broadcast, and single-homed hosts
+    Ipv4Address destination = header.GetDestination();
+    Ptr<Ipv4Route> route;
+    if (!oif && !destination.IsMulticast() && !destination.IsBroadcast()) {
+        Ptr<const Packet> transport = header.GetProtocol() == 6 ? p : Ptr<Packet>();
+        bool unreachable = false;
+        // While links are down, global routing's table is stale: follow route repair. With no
+        // live path left the packet falls back to global routing and is lost on the way.
+        if (m_repair && m_repair->IsActive()) {
+            route = RepairedRoute(header, transport, true, unreachable);
+        } else if (m_mode != ECMP_OFF) {
+            route = EqualCostRoute(header, transport, true);
+        }
+    }
+    sockerr = route ? Socket::ERROR_NOTERROR : Socket::ERROR_NOROUTETOHOST;
+    return route;
+}
+
+Ptr<Ipv4Route> EcmpRouting::EqualCostRoute(const Ipv4Header& header, Ptr<const Packet> p, bool local) {
+    const std::vector<Ipv4RoutingTableEntry *>& routes = Candidates(header.GetDestination());
+    m_up.clear();
+    for (size_t i = 0; i < routes.size(); ++i) {
+        if (m_ipv4->IsUp(routes[i]->GetInterface())) {
+            m_up.push_back(routes[i]);
+        }
+    }
+    if (m_up.size() < 2) {
+        return 0;
+    }
+    Ipv4RoutingTableEntry *chosen = m_up[ChoosePath(header, p, m_up.size())];
+    return MakeRoute(header, chosen->GetInterface(), chosen->GetGateway(), local);
+}
+
+Ptr<Ipv4Route> EcmpRouting::MakeRoute(const Ipv4Header& header, uint32_t interface, Ipv4Address gateway, bool local) const {
+    Ipv4Address source = header.GetSource();
+    Ptr<Ipv4Route> route = Create<Ipv4Route>();
+    route->SetDestination(header.GetDestination());
+    route->SetGateway(gateway);
+    if (!local || source == Ipv4Address::GetAny()) {
+        source = m_ipv4->GetAddress(interface, 0).GetLocal();
+    }
+    route->SetSource(source);
+    route->SetOutputDevice(m_ipv4->GetNetDevice(interface));
+    return route;
+}
+
+bool EcmpRouting::RouteInput(Ptr<const Packet> p, const Ipv4Header& header, Ptr<const NetDevice> idev,
+                             UnicastForwardCallback ucb, MulticastForwardCallback,
+                             LocalDeliverCallback, ErrorCallback ecb) {
+    Ipv4Address destination = header.GetDestination();
+    bool repairing = m_repair && m_repair->IsActive();
+    if ((m_mode == ECMP_OFF && !repairing) || destination.IsMulticast() || destination.IsBroadcast()
+        || !m_ipv4->IsForwarding(m_ipv4->GetInterfaceForDevice(idev))) {
+        return false;
+    }
+    Ptr<Ipv4Route> route;
+    if (repairing) {
+        bool unreachable = false;
+        route = RepairedRoute(header, p, false, unreachable);
+        if (unreachable) {
+            ecb(p, header, Socket::ERROR_NOROUTETOHOST);
+            return true;
+        }
+    } else {
+        route = EqualCostRoute(header, p, false);
+    }
+    if (!route) {
+        return false;
+    }
+    ucb(route, p, header);
+    return true;
+}
+
+uint32_t EcmpRouting::ChoosePath(const Ipv4Header& header, Ptr<const Packet> p, uint32_t n) {
+    if (m_mode == ECMP_OFF || n == 1) {
+        return 0;
+    }
+    uint64_t hash = MixHash(FlowKeyHash()(MakeFlowKey(header, p)) ^ m_salt);
+    if (m_mode == ECMP_FLOWLET) {
+        Time now = Simulator::Now();
+        // Drop the idle flowlets whenever the table doubles, so it tracks the active flows only
+        if (m_flowlets.size() >= m_flowletSweep) {
+            for (std::unordered_map<uint64_t, Flowlet>::iterator it = m_flowlets.begin(); it != m_flowlets.end();) {
+                it = now - it->second.last > m_flowletGap ? m_flowlets.erase(it) : ++it;
+            }
+            m_flowletSweep = std::max<size_t>(64, 2 * m_flowlets.size());
+        }
+        std::pair<std::unordered_map<uint64_t, Flowlet>::iterator, bool> slot =
+            m_flowlets.insert(std::make_pair(hash, Flowlet()));
+        Flowlet& flowlet = slot.first->second;
+        if (slot.second || now - flowlet.last > m_flowletGap) {
+            flowlet.start = now;
+        }
+        flowlet.last = now;
+        hash = MixHash(hash + flowlet.start.GetTimeStep());
+    }
+    return hash % n;
+}
+
+Ptr<Ipv4Route> EcmpRouting::RepairedRoute(const Ipv4Header& header, Ptr<const Packet> p, bool local, bool& unreachable) {
+    uint32_t target = m_repair->NodeOfAddress(header.GetDestination());
+    if (target == kNoNode || target == m_node) {
+        return 0;
+    }
+    const std::vector<uint32_t>& hops = m_repair->NextHops(m_node, target);
+    if (hops.empty()) {
+        unreachable = true;
+        return 0;
+    }
+    uint32_t hop = hops[ChoosePath(header, p, hops.size())];
+    uint32_t interface = m_ipv4->GetInterfaceForDevice(m_repair->GetDevice(hop));
+    return MakeRoute(header, interface, m_repair->GetPeerAddress(hop), local);
+}
+
+void EcmpRouting::PrintRoutingTable(Ptr<OutputStreamWrapper> stream, Time::Unit) const {
+    *stream->GetStream() << "ECMP over global routing, " << (m_mode == ECMP_FLOWLET ? "per flowlet" : "per flow")
+                         << ", " << m_candidates.size() << " cached destinations\n";
+}
+
+
+// Link load accounting
+//
+// Counts the packets and bytes every link device transmits; utilization is
+// relative to the device's own DataRate over the measured interval. Queue
+// occupancy is followed through the length traces of the device queue and of
+// the traffic-control queue disc in front of it, so the time-weighted mean and
+// peak are exact, and drops are counted in both.
+
+class LinkLoadMonitor {
+public:
+    LinkLoadMonitor(const CampusTopology& topology);
+
+    // Connects the transmit, queue length and drop traces of every link device and starts the interval
+    void Start(void);
+
+    uint64_t GetBytes(uint32_t device) const { return m_bytes[device]; }
+    uint64_t GetPackets(uint32_t device) const { return m_packets[device]; }
+    uint64_t GetBitRate(uint32_t device) const { return m_bitRates[device]; }
+    // Share of the device's capacity used since Start
+    double GetUtilization(uint32_t device) const;
+    // Packets queued for the device, queue disc included: time-weighted mean since Start, and peak
+    double GetMeanQueue(uint32_t device) const;
+    uint32_t GetPeakQueue(uint32_t device) const { return m_queues[device].peak; }
+    // Mean time transmitted packets spent queued for the device (Little's law)
+    double GetQueueDelay(uint32_t device) const;
+    uint64_t GetDrops(uint32_t device) const { return m_queues[device].drops; }
+    // Over every device
+    uint64_t GetTotalPackets(void) const { return std::accumulate(m_packets.begin(), m_packets.end(), (uint64_t)0); }
+    uint64_t GetTotalDrops(void) const;
+    // Sums the counters of every rank into the root's
+    void MergeAcrossRanks(uint32_t root);
+
+private:
+    struct QueueState {
+        uint32_t deviceQueue;
+        uint32_t discQueue;
+        uint32_t peak;
+        double area;                // packet-seconds up to lastChange
+        Time lastChange;
+        uint64_t drops;
+    };
+
+    static void Transmitted(LinkLoadMonitor *monitor, uint32_t device, Ptr<const Packet> packet);
+    static void DeviceQueueChanged(LinkLoadMonitor *monitor, uint32_t device, uint32_t oldValue, uint32_t newValue);
+    static void DiscQueueChanged(LinkLoadMonitor *monitor, uint32_t device, uint32_t oldValue, uint32_t newValue);
+    static void DeviceQueueDropped(LinkLoadMonitor *monitor, uint32_t device, Ptr<const Packet> packet);
+    static void DiscDropped(LinkLoadMonitor *monitor, uint32_t device, Ptr<const QueueDiscItem> item);
+    // Accounts the occupancy up to now before it changes
+    void Advance(QueueState& queue);
+    // Packet-seconds queued since Start
+    double GetQueueArea(uint32_t device) const;
+
+    const CampusTopology& m_topology;
+    std::vector<uint64_t> m_bytes;
+    std::vector<uint64_t> m_packets;
+    std::vector<uint64_t> m_bitRates;
+    std::vector<QueueState> m_queues;
+    Time m_start;
+};
+
+LinkLoadMonitor::LinkLoadMonitor(const CampusTopology& topology) : m_topology(topology) {}
+
+void LinkLoadMonitor::Start(void) {
+    uint32_t devices = m_topology.linkDevices.size();
+    m_bytes.assign(devices, 0);
+    m_packets.assign(devices, 0);
+    m_bitRates.assign(devices, 0);
+    m_start = Simulator::Now();
+    QueueState empty = { 0, 0, 0, 0.0, m_start, 0 };
+    m_queues.assign(devices, empty);
+    for (uint32_t i = 0; i < devices; ++i) {
+        Ptr<NetDevice> device = m_topology.linkDevices[i];
+        DataRateValue rate;
+        device->GetAttribute("DataRate", rate);
+        m_bitRates[i] = rate.Get().GetBitRate();
+        device->TraceConnectWithoutContext("PhyTxEnd", MakeBoundCallback(&LinkLoadMonitor::Transmitted, this, i));
+        Ptr<PointToPointNetDevice> p2p = DynamicCast<PointToPointNetDevice>(device);
+        if (p2p) {
+            p2p->GetQueue()->TraceConnectWithoutContext("PacketsInQueue",
+                MakeBoundCallback(&LinkLoadMonitor::DeviceQueueChanged, this, i));
+            p2p->GetQueue()->TraceConnectWithoutContext("Drop",
+                MakeBoundCallback(&LinkLoadMonitor::DeviceQueueDropped, this, i));
+        }
+        Ptr<QueueDisc> disc = GetDeviceQueueDisc(device);
+        if (disc) {
+            disc->TraceConnectWithoutContext("PacketsInQueue", MakeBoundCallback(&LinkLoadMonitor::DiscQueueChanged, this, i));
+            disc->TraceConnectWithoutContext("Drop", MakeBoundCallback(&LinkLoadMonitor::DiscDropped, this, i));
+        }
+    }
+}
+
+void LinkLoadMonitor::Transmitted(LinkLoadMonitor *monitor, uint32_t device, Ptr<const Packet> packet) {
+    monitor->m_bytes[device] += packet->GetSize();
+    monitor->m_packets[device]++;
+}
+
+void LinkLoadMonitor::Advance(QueueState& queue) {
+    Time now = Simulator::Now();
+    queue.area += (queue.deviceQueue + queue.discQueue) * (now - queue.lastChange).GetSeconds();
+    queue.lastChange = now;
+}
+
+void LinkLoadMonitor::DeviceQueueChanged(LinkLoadMonitor *monitor, uint32_t device, uint32_t, uint32_t newValue) {
+    QueueState& queue = monitor->m_queues[device];
+    monitor->Advance(queue);
+    queue.deviceQueue = newValue;
+    queue.peak = std::max(queue.peak, queue.deviceQueue + queue.discQueue);
+}
+
+void LinkLoadMonitor::DiscQueueChanged(LinkLoadMonitor *monitor, uint32_t device, uint32_t, uint32_t newValue) {
+    QueueState& queue = monitor->m_queues[device];
+    monitor->Advance(queue);
+    queue.discQueue = newValue;
+    queue.peak = std::max(queue.peak, queue.deviceQueue + queue.discQueue);
+}
+
+void LinkLoadMonitor::DeviceQueueDropped(LinkLoadMonitor *monitor, uint32_t device, Ptr<const Packet>) {
+    monitor->m_queues[device].drops++;
+}
+
+void LinkLoadMonitor::DiscDropped(LinkLoadMonitor *monitor, uint32_t device, Ptr<const QueueDiscItem>) {
+    monitor->m_queues[device].drops++;
+}
+
+uint64_t LinkLoadMonitor::GetTotalDrops(void) const {
+    uint64_t drops = 0;
+    for (size_t i = 0; i < m_queues.size(); ++i) {
+        drops += m_queues[i].drops;
+    }
+    return drops;
+}
+
+double LinkLoadMonitor::GetUtilization(uint32_t device) const {
+    double seconds = (Simulator::Now() - m_start).GetSeconds();
+    return seconds > 0 && m_bitRates[device] > 0 ? m_bytes[device] * 8.0 / (m_bitRates[device] * seconds) : 0.0;
+}
+
+double LinkLoadMonitor::GetMeanQueue(uint32_t device) const {
+    double seconds = (Simulator::Now() - m_start).GetSeconds();
+    return seconds > 0 ? GetQueueArea(device) / seconds : 0.0;
+}
+
+double LinkLoadMonitor::GetQueueDelay(uint32_t device) const {
+    return m_packets[device] > 0 ? GetQueueArea(device) / m_packets[device] : 0.0;
+}
+
+double LinkLoadMonitor::GetQueueArea(uint32_t device) const {
+    const QueueState& queue = m_queues[device];
+    return queue.area + (queue.deviceQueue + queue.discQueue) * (Simulator::Now() - queue.lastChange).GetSeconds();
+}
+
+void LinkLoadMonitor::MergeAcrossRanks(uint32_t root) {
+#ifdef NS3_MPI
+    if (RankCount() == 1 || m_bytes.empty()) {
+        return;
+    }
+    // A device lives on one rank, so its queue counters sum; occupancy still queued is settled first
+    std::vector<uint64_t> drops(m_queues.size()), peaks(m_queues.size());
+    std::vector<double> areas(m_queues.size());
+    for (size_t i = 0; i < m_queues.size(); ++i) {
+        Advance(m_queues[i]);
+        drops[i] = m_queues[i].drops;
+        peaks[i] = m_queues[i].peak;
+        areas[i] = m_queues[i].area;
+    }
+    std::vector<uint64_t> bytes(m_bytes.size()), packets(m_packets.size());
+    std::vector<uint64_t> totalDrops(drops.size()), maxPeaks(peaks.size());
+    std::vector<double> totalAreas(areas.size());
+    MPI_Reduce(&m_bytes[0], &bytes[0], m_bytes.size(), MPI_UINT64_T, MPI_SUM, root, MPI_COMM_WORLD);
+    MPI_Reduce(&m_packets[0], &packets[0], m_packets.size(), MPI_UINT64_T, MPI_SUM, root, MPI_COMM_WORLD);
+    MPI_Reduce(&drops[0], &totalDrops[0], drops.size(), MPI_UINT64_T, MPI_SUM, root, MPI_COMM_WORLD);
+    MPI_Reduce(&peaks[0], &maxPeaks[0], peaks.size(), MPI_UINT64_T, MPI_MAX, root, MPI_COMM_WORLD);
+    MPI_Reduce(&areas[0], &totalAreas[0], areas.size(), MPI_DOUBLE, MPI_SUM, root, MPI_COMM_WORLD);
+    if (LocalRank() == root) {
+        m_bytes.swap(bytes);
+        m_packets.swap(packets);
+        for (size_t i = 0; i < m_queues.size(); ++i) {
+            m_queues[i].drops = totalDrops[i];
+            m_queues[i].peak = maxPeaks[i];
+            m_queues[i].area = totalAreas[i];
+        }
+    }
+#else
+    (void)root;
+#endif
+}
+
+
+// Failure injection
+//
+// Each scheduled failure takes a backbone link, or every link of a switch, down
+// at its start time and back up at its end: the interfaces on both ends go down,
+// so traffic into them is dropped, and routers act on the change after the
+// convergence delay. For every failure the injector compares each flow's
+// delivered bytes in equal windows before, during and after the outage, and
+// counts its drops and TCP retransmissions from the failure until one window
+// after recovery. Flows with drops or retransmissions are reported as affected.
+// Drops are those of IP, of the link device queues and of the queue discs in
+// front of them, so packets stranded behind a downed link count too.
+// Deliveries come from the packet statistics collector, whose send-time tags
+// tell packets sent after the failure from those already in flight: a flow has
+// recovered at the first delivery of a packet sent after the failure, and its
+// stall is the longest gap between deliveries that ends, or is still open, after
+// the failure.
+
+class FailureInjector {
+public:
+    FailureInjector(const CampusTopology& topology, RouteRepair& repair, Time convergence);
+
+    // Schedules the failures, follows the collector's deliveries and hooks the IP send trace and the
+    // IP, device queue and queue disc drop traces
+    void Schedule(const std::vector<FailureEvent>& events, PacketStatsCollector& packets);
+
+    // One row per failure and affected flow; sums into the run metrics
+    void Export(MetricsTable& table, NetworkMetrics& metrics) const;
+
+private:
+    struct FlowImpact {
+        uint64_t bytesBefore;
+        uint64_t bytesDuring;
+        uint64_t bytesAfter;
+        uint32_t lost;
+        uint32_t retransmissions;
+        Time lastDelivery;          // zero if none yet
+        Time longestGap;            // between deliveries, ending after the failure
+        Time recovered;             // first delivery of a packet sent after the failure, zero if none
+    };
+
+    struct FlowState {
+        FlowKey key;
+        uint32_t highestSequence;   // end of the highest TCP payload sent
+        bool sent;
+    };
+
+    void SetFailed(uint32_t event, bool failed);
+    std::vector<uint32_t> LinksOf(const FailureEvent& event) const;
+    uint32_t FlowOf(const FlowKey& key);
+    FlowImpact& Impact(uint32_t event, uint32_t flow);
+
+    void PacketSent(const Ipv4Header& header, Ptr<const Packet> packet, uint32_t interface);
+    void Delivered(const FlowKey& key, Time delay, uint32_t bytes);
+    void PacketDropped(const Ipv4Header& header, Ptr<const Packet> packet, Ipv4L3Protocol::DropReason,
+                       Ptr<Ipv4>, uint32_t);
+    void DeviceQueueDropped(Ptr<const Packet> frame);
+    void DiscDropped(Ptr<const QueueDiscItem> item);
+    // Counts a drop against every failure whose window is open
+    void CountLoss(const FlowKey& key);
+
+    const CampusTopology& m_topology;
+    RouteRepair& m_repair;
+    Time m_convergence;
+    std::vector<FailureEvent> m_events;
+    std::unordered_map<FlowKey, uint32_t, FlowKeyHash> m_flowIndex;
+    std::vector<FlowState> m_flows;
+    std::vector<std::vector<FlowImpact> > m_impacts;    // per event, per flow
+};
+
+FailureInjector::FailureInjector(const CampusTopology& topology, RouteRepair& repair, Time convergence)
+    : m_topology(topology), m_repair(repair), m_convergence(convergence) {}
+
+void FailureInjector::Schedule(const std::vector<FailureEvent>& events, PacketStatsCollector& packets) {
+    m_events = events;
+    m_impacts.resize(events.size());
+    for (uint32_t e = 0; e < events.size(); ++e) {
+        NS_ABORT_MSG_IF(events[e].down >= events[e].up, "Failure " << e << " ends before it starts");
+        NS_ABORT_MSG_IF(LinksOf(events[e]).empty(), "Failure " << e << " matches no link");
+        Simulator::Schedule(Seconds(events[e].down), &FailureInjector::SetFailed, this, e, true);
+        Simulator::Schedule(Seconds(events[e].up), &FailureInjector::SetFailed, this, e, false);
+    }
+    Config::ConnectWithoutContext("/NodeList/*/$ns3::Ipv4L3Protocol/SendOutgoing",
+                                  MakeCallback(&FailureInjector::PacketSent, this));
+    packets.AddDeliveryCallback(MakeCallback(&FailureInjector::Delivered, this));
+    Config::ConnectWithoutContext("/NodeList/*/$ns3::Ipv4L3Protocol/Drop",
+                                  MakeCallback(&FailureInjector::PacketDropped, this));
+    for (uint32_t i = 0; i < m_topology.linkDevices.size(); ++i) {
+        Ptr<PointToPointNetDevice> p2p = DynamicCast<PointToPointNetDevice>(m_topology.linkDevices[i]);
+        if (p2p) {
+            p2p->GetQueue()->TraceConnectWithoutContext("Drop",
+                MakeCallback(&FailureInjector::DeviceQueueDropped, this));
+        }
+        Ptr<QueueDisc> disc = GetDeviceQueueDisc(m_topology.linkDevices[i]);
+        if (disc) {
+            disc->TraceConnectWithoutContext("Drop", MakeCallback(&FailureInjector::DiscDropped, this));
+        }
+    }
+}
+
+std::vector<uint32_t> FailureInjector::LinksOf(const FailureEvent& event) const {
+    std::vector<uint32_t> links;
+    for (uint32_t i = 0; i < m_topology.GetNLinks(); ++i) {
+        const TopologyLink& link = m_topology.links[i];
+        if (event.node ? (link.nodeA == event.id || link.nodeB == event.id) : i == event.id) {
+            links.push_back(i);
+        }
+    }
+    return links;
+}
+
+void FailureInjector::SetFailed(uint32_t event, bool failed) {
+    std::vector<uint32_t> links = LinksOf(m_events[event]);
+    for (size_t l = 0; l < links.size(); ++l) {
+        m_repair.SetLinkState(links[l], !failed);
+        bool down = m_repair.IsLinkFailed(links[l]);
+        for (uint32_t side = 0; side < 2; ++side) {
+            Ptr<NetDevice> device = m_topology.linkDevices[2 * links[l] + side];
+            Ptr<Ipv4> ipv4 = device->GetNode()->GetObject<Ipv4>();
+            uint32_t interface = ipv4->GetInterfaceForDevice(device);
+            if (down) {
+                ipv4->SetDown(interface);
+            } else {
+                ipv4->SetUp(interface);
+            }
+        }
+    }
+    Simulator::Schedule(m_convergence, &RouteRepair::Converge, &m_repair);
+}
+
+uint32_t FailureInjector::FlowOf(const FlowKey& key) {
+    std::pair<std::unordered_map<FlowKey, uint32_t, FlowKeyHash>::iterator, bool> slot =
+        m_flowIndex.insert(std::make_pair(key, (uint32_t)m_flows.size()));
+    if (slot.second) {
+        FlowState state = { key, 0, false };
+        m_flows.push_back(state);
+    }
+    return slot.first->second;
+}
+
+FailureInjector::FlowImpact& FailureInjector::Impact(uint32_t event, uint32_t flow) {
+    std::vector<FlowImpact>& impacts = m_impacts[event];
+    if (flow >= impacts.size()) {
+        FlowImpact none = { 0, 0, 0, 0, 0, Time(), Time(), Time() };
+        impacts.resize(flow + 1, none);
+    }
+    return impacts[flow];
+}
+
+void FailureInjector::PacketSent(const Ipv4Header& header, Ptr<const Packet> packet, uint32_t) {
+    if (header.GetProtocol() != 6) {
+        return;
+    }
+    TcpHeader tcp;
+    packet->PeekHeader(tcp);
+    uint32_t payload = packet->GetSize() - tcp.GetSerializedSize();
+    if (payload == 0) {
+        return;
+    }
+    uint32_t index = FlowOf(MakeFlowKey(header, packet));
+    FlowState& flow = m_flows[index];
+    uint32_t end = tcp.GetSequenceNumber().GetValue() + payload;
+    bool retransmission = flow.sent && (int32_t)(end - flow.highestSequence) <= 0;
+    if (!retransmission) {
+        flow.highestSequence = end;
+        flow.sent = true;
+        return;
+    }
+    double now = Simulator::Now().GetSeconds();
+    for (uint32_t e = 0; e < m_events.size(); ++e) {
+        const FailureEvent& event = m_events[e];
+        if (now >= event.down && now < 2 * event.up - event.down) {
+            Impact(e, index).retransmissions++;
+        }
+    }
+}
+
+void FailureInjector::Delivered(const FlowKey& key, Time delay, uint32_t bytes) {
+    uint32_t flow = FlowOf(key);
+    Time now = Simulator::Now();
+    double seconds = now.GetSeconds();
+    double sent = (now - delay).GetSeconds();
+    for (uint32_t e = 0; e < m_events.size(); ++e) {
+        const FailureEvent& event = m_events[e];
+        double window = event.up - event.down;
+        if (seconds < event.down - window || seconds >= event.up + window) {
+            continue;
+        }
+        FlowImpact& impact = Impact(e, flow);
+        if (seconds < event.down) {
+            impact.bytesBefore += bytes;
+        } else {
+            (seconds < event.up ? impact.bytesDuring : impact.bytesAfter) += bytes;
+            if (!impact.lastDelivery.IsZero()) {
+                impact.longestGap = std::max(impact.longestGap, now - impact.lastDelivery);
+            }
+            if (sent >= event.down && impact.recovered.IsZero()) {
+                impact.recovered = now;
+            }
+        }
+        impact.lastDelivery = now;
+    }
+}
+
+void FailureInjector::PacketDropped(const Ipv4Header& header, Ptr<const Packet> packet, Ipv4L3Protocol::DropReason,
+                                    Ptr<Ipv4>, uint32_t) {
+    CountLoss(MakeFlowKey(header, packet));
+}
+
+void FailureInjector::DeviceQueueDropped(Ptr<const Packet> frame) {
+    FlowKey key;
+    if (MakeFrameFlowKey(frame, key)) {
+        CountLoss(key);
+    }
+}
+
+void FailureInjector::DiscDropped(Ptr<const QueueDiscItem> item) {
+    Ptr<const Ipv4QueueDiscItem> ipv4 = DynamicCast<const Ipv4QueueDiscItem>(item);
+    if (ipv4) {
+        CountLoss(MakeFlowKey(ipv4->GetHeader(), ipv4->GetPacket()));
+    }
+}
+
+void FailureInjector::CountLoss(const FlowKey& key) {
+    uint32_t flow = FlowOf(key);
+    double now = Simulator::Now().GetSeconds();
+    for (uint32_t e = 0; e < m_events.size(); ++e) {
+        const FailureEvent& event = m_events[e];
+        if (now >= event.down && now < 2 * event.up - event.down) {
+            Impact(e, flow).lost++;
+        }
+    }
+}
+
+void FailureInjector::Export(MetricsTable& table, NetworkMetrics& metrics) const {
+    std::ostringstream text;
+    double dipSum = 0.0;
+    uint32_t affected = 0;
+    for (uint32_t e = 0; e < m_events.size(); ++e) {
+        const FailureEvent& event = m_events[e];
+        double window = event.up - event.down;
+        text.str("");
+        text << (event.node ? "node:" : "link:") << event.id << "@" << event.down << "-" << event.up;
+        std::string name = text.str();
+        for (uint32_t f = 0; f < m_impacts[e].size(); ++f) {
+            const FlowImpact& impact = m_impacts[e][f];
+            if (impact.lost == 0 && impact.retransmissions == 0) {
+                continue;
+            }
+            const FlowKey& key = m_flows[f].key;
+            text.str("");
+            text << Ipv4Address(key.source) << ":" << key.sourcePort;
+            std::string source = text.str();
+            text.str("");
+            text << Ipv4Address(key.destination) << ":" << key.destinationPort;
+            double before = impact.bytesBefore / window;
+            double during = impact.bytesDuring / window;
+            double dip = before > 0 ? std::max(0.0, 1.0 - during / before) : 0.0;
+            // A flow that never recovered stalls until the end of the window after the outage
+            double end = event.up + window;
+            double recovery = impact.recovered.IsZero() ? end - event.down : impact.recovered.GetSeconds() - event.down;
+            double stall = impact.longestGap.GetSeconds();
+            if (impact.recovered.IsZero()) {
+                stall = std::max(stall, end - std::max(impact.lastDelivery.GetSeconds(), event.down));
+            }
+            table.AddRow({ name, source, text.str() }, {
+                (double)impact.lost, (double)impact.retransmissions, before, during, impact.bytesAfter / window,
+                dip, stall, recovery });
+            metrics.failureLostPackets += impact.lost;
+            metrics.failureRetransmissions += impact.retransmissions;
+            metrics.failureRecoveryTime = std::max(metrics.failureRecoveryTime, recovery);
+            dipSum += dip;
+            affected++;
+        }
+    }
+    metrics.failureThroughputDip = affected > 0 ? dipSum / affected : 0.0;
+}
+
+
+// Steady-state detection
+//
+// From the moment the clients start, the convergence monitor cuts the run into
+// batches of equal length and keeps one value per batch of each key metric:
+// throughput into the server, mean and p99 delay of the packets reaching it, and
+// the share of link transmissions lost to queue drops. After every batch the
+// warm-up transient is cut with MSER (the truncation that minimizes the standard
+// error of the remaining batches, at most half of them), adjacent batches are
+// merged while their means are still correlated, and once every metric's 95%
+// confidence half-width is within the target precision of its mean the
+// simulation stops. A relative target never settles a metric whose mean is near
+// zero, and a lossless campus has exactly that loss ratio, so the loss ratio also
+// counts as settled once its half-width is below an absolute tolerance. MSER and
+// the batch means are in campus_statistics.h.
+
+class ConvergenceMonitor {
+public:
+    enum Metric { THROUGHPUT, MEAN_DELAY, P99_DELAY, LOSS, METRIC_COUNT };
+
+    ConvergenceMonitor(Ipv4Address server, const LinkLoadMonitor& links, Time batch, double precision,
+                       double lossTolerance, uint32_t minBatches);
+
+    // Follows the collector's deliveries and closes the first batch one interval after start
+    void Start(PacketStatsCollector& packets, Time start);
+
+    bool IsConverged(void) const { return m_converged; }
+    // Seconds of warm-up discarded
+    double GetWarmup(void) const { return m_warmup * m_batch.GetSeconds(); }
+    // Largest relative half-width among the metrics not settled by an absolute tolerance
+    double GetPrecision(void) const;
+    // One row per metric
+    void Export(MetricsTable& table) const;
+
+private:
+    typedef BatchMeansEstimate Estimate;
+
+    void Begin(void);
+    void Delivered(const FlowKey& key, Time delay, uint32_t bytes);
+    void CloseBatch(void);
+    void Evaluate(void);
+    // Half-width below which a metric counts as settled
+    double GetTolerance(uint32_t metric, const Estimate& estimate) const;
+
+    uint32_t m_server;
+    const LinkLoadMonitor& m_links;
+    Time m_batch;
+    double m_precision;
+    double m_lossTolerance;
+    uint32_t m_minBatches;
+    bool m_started;
+    StreamingDelayStats m_current;
+    uint64_t m_drops;           // link totals at the start of the batch
+    uint64_t m_transmitted;
+    std::vector<double> m_series[METRIC_COUNT];
+    uint32_t m_warmup;          // batches
+    Estimate m_estimates[METRIC_COUNT];
+    bool m_converged;
+};
+
+static const char *kConvergenceMetricNames[ConvergenceMonitor::METRIC_COUNT] = {
+    "throughput", "meanDelay", "p99Delay", "loss"
+};
+
+ConvergenceMonitor::ConvergenceMonitor(Ipv4Address server, const LinkLoadMonitor& links, Time batch, double precision,
+                                       double lossTolerance, uint32_t minBatches)
+    : m_server(server.Get()), m_links(links), m_batch(batch), m_precision(precision), m_lossTolerance(lossTolerance),
+      m_minBatches(std::max(2u, minBatches)),
+      m_started(false), m_drops(0), m_transmitted(0), m_warmup(0), m_converged(false) {
+    Estimate none = { 0.0, 0.0, 0 };
+    std::fill(m_estimates, m_estimates + METRIC_COUNT, none);
+}
+
+void ConvergenceMonitor::Start(PacketStatsCollector& packets, Time start) {
+    NS_ABORT_MSG_IF(!m_batch.IsStrictlyPositive(), "Convergence batches need a positive length");
+    packets.AddDeliveryCallback(MakeCallback(&ConvergenceMonitor::Delivered, this));
+    Simulator::Schedule(start, &ConvergenceMonitor::Begin, this);
+}
+
+void ConvergenceMonitor::Begin(void) {
+    m_started = true;
+    m_drops = m_links.GetTotalDrops();
+    m_transmitted = m_links.GetTotalPackets();
+    Simulator::Schedule(m_batch, &ConvergenceMonitor::CloseBatch, this);
+}
+
+void ConvergenceMonitor::Delivered(const FlowKey& key, Time delay, uint32_t bytes) {
+    if (m_started && key.destination == m_server) {
+        m_current.Add(delay, bytes);
+    }
+}
+
+void ConvergenceMonitor::CloseBatch(void) {
+    uint64_t drops = m_links.GetTotalDrops() - m_drops;
+    uint64_t transmitted = m_links.GetTotalPackets() - m_transmitted;
+    m_series[THROUGHPUT].push_back(m_current.GetBytes() / m_batch.GetSeconds());
+    m_series[MEAN_DELAY].push_back(m_current.GetMean());
+    m_series[P99_DELAY].push_back(m_current.GetQuantile(0.99));
+    m_series[LOSS].push_back(drops + transmitted > 0 ? (double)drops / (drops + transmitted) : 0.0);
+    m_current = StreamingDelayStats();
+    m_drops += drops;
+    m_transmitted += transmitted;
+
+    Evaluate();
+    if (m_converged && m_precision > 0) {
+        Simulator::Stop();
+        return;
+    }
+    Simulator::Schedule(m_batch, &ConvergenceMonitor::CloseBatch, this);
+}
+
+void ConvergenceMonitor::Evaluate(void) {
+    uint32_t batches = m_series[0].size();
+    m_warmup = 0;
+    for (uint32_t m = 0; m < METRIC_COUNT; ++m) {
+        m_warmup = std::max(m_warmup, MserTruncation(m_series[m]));
+    }
+    if (batches - m_warmup < m_minBatches) {
+        return;
+    }
+    m_converged = true;
+    for (uint32_t m = 0; m < METRIC_COUNT; ++m) {
+        std::vector<double> kept(m_series[m].begin() + m_warmup, m_series[m].end());
+        m_estimates[m] = BatchMeans(kept, m_minBatches);
+        m_converged = m_converged && m_estimates[m].batches >= m_minBatches
+                      && m_estimates[m].halfWidth <= GetTolerance(m, m_estimates[m]);
+    }
+}
+
+double ConvergenceMonitor::GetTolerance(uint32_t metric, const Estimate& estimate) const {
+    double tolerance = m_precision * std::fabs(estimate.mean);
+    return metric == LOSS ? std::max(tolerance, m_lossTolerance) : tolerance;
+}
+
+double ConvergenceMonitor::GetPrecision(void) const {
+    double worst = 0.0;
+    for (uint32_t m = 0; m < METRIC_COUNT; ++m) {
+        const Estimate& estimate = m_estimates[m];
+        if (estimate.halfWidth > 0 && !(m == LOSS && estimate.halfWidth <= m_lossTolerance)) {
+            worst = std::max(worst, estimate.mean != 0 ? estimate.halfWidth / std::fabs(estimate.mean)
+                                                       : std::numeric_limits<double>::infinity());
+        }
+    }
+    return worst;
+}
+
+void ConvergenceMonitor::Export(MetricsTable& table) const {
+    for (uint32_t m = 0; m < METRIC_COUNT && m_started; ++m) {
+        const Estimate& estimate = m_estimates[m];
+        table.AddRow({ kConvergenceMetricNames[m] }, {
+            estimate.mean, estimate.halfWidth, estimate.mean != 0 ? estimate.halfWidth / std::fabs(estimate.mean) : 0.0,
+            (double)estimate.batches, (double)m_series[m].size(), GetWarmup() });
+    }
+}
+
+
+// Time-windowed sampling
+//
+// Every interval the sampler writes one row per flow that delivered packets and
+// one row per link that transmitted or dropped, with the counts accumulated since
+// the previous sample. Idle flows and links cost nothing. Queued packets include
+// the device's queue disc.
+//   <time>,f,<flow>,<packets>,<bytes>,<mean delay ms>
+//   <time>,l,<device>,<packets>,<bytes>,<queued packets>
+//   <time>,d,<device>,<dropped packets>,<dropped bytes>,<queued packets>
+// Flow and device ids are resolved in <file>.index.
+
+class TimeSeriesSampler {
+public:
+    TimeSeriesSampler(const CampusTopology& topology, PacketStatsCollector& packets, Time interval, std::string filename);
+
+    // Connects the per-device transmit traces and schedules the first sample
+    void Start(void);
+    // Writes the final partial window and the id index
+    void Finish(void);
+
+private:
+    struct LinkWindow {
+        uint32_t packets;
+        uint64_t bytes;
+        uint32_t drops;
+        uint64_t dropBytes;
+        bool dirty;
+    };
+
+    static void LinkTransmitted(TimeSeriesSampler *sampler, uint32_t device, Ptr<const Packet> packet);
+    static void QueueDropped(TimeSeriesSampler *sampler, uint32_t device, Ptr<const Packet> packet);
+    static void DiscDropped(TimeSeriesSampler *sampler, uint32_t device, Ptr<const QueueDiscItem> item);
+    LinkWindow& Touch(uint32_t device);
+    uint32_t QueuedPackets(uint32_t device) const;
+    void Sample(void);
+
+    const CampusTopology& m_topology;
+    PacketStatsCollector& m_packets;
+    Time m_interval;
+    std::string m_filename;
+    std::ofstream m_out;
+    std::vector<LinkWindow> m_links;
+    std::vector<Ptr<QueueDisc> > m_discs;
+    std::vector<uint32_t> m_dirtyLinks;
+    std::vector<FlowWindowSample> m_flowSamples;
+    EventId m_event;
+};
+
+TimeSeriesSampler::TimeSeriesSampler(const CampusTopology& topology, PacketStatsCollector& packets, Time interval, std::string filename)
+    : m_topology(topology), m_packets(packets), m_interval(interval), m_filename(filename) {}
+
+void TimeSeriesSampler::Start(void) {
+    m_out.open(m_filename.c_str());
+    m_out << "time,kind,id,packets,bytes,value\n";
+    LinkWindow empty = { 0, 0, 0, 0, false };
+    m_links.assign(m_topology.linkDevices.size(), empty);
+    m_discs.resize(m_topology.linkDevices.size());
+    for (uint32_t i = 0; i < m_topology.linkDevices.size(); ++i) {
+        m_topology.linkDevices[i]->TraceConnectWithoutContext("PhyTxEnd",
+            MakeBoundCallback(&TimeSeriesSampler::LinkTransmitted, this, i));
+        Ptr<PointToPointNetDevice> p2p = DynamicCast<PointToPointNetDevice>(m_topology.linkDevices[i]);
+        if (p2p) {
+            p2p->GetQueue()->TraceConnectWithoutContext("Drop", MakeBoundCallback(&TimeSeriesSampler::QueueDropped, this, i));
+        }
+        m_discs[i] = GetDeviceQueueDisc(m_topology.linkDevices[i]);
+        if (m_discs[i]) {
+            m_discs[i]->TraceConnectWithoutContext("Drop", MakeBoundCallback(&TimeSeriesSampler::DiscDropped, this, i));
+        }
+    }
+    m_packets.EnableWindows();
+    m_event = Simulator::Schedule(m_interval, &TimeSeriesSampler::Sample, this);
+}
+
+TimeSeriesSampler::LinkWindow& TimeSeriesSampler::Touch(uint32_t device) {
+    LinkWindow& window = m_links[device];
+    if (!window.dirty) {
+        window.dirty = true;
+        m_dirtyLinks.push_back(device);
+    }
+    return window;
+}
+
+void TimeSeriesSampler::LinkTransmitted(TimeSeriesSampler *sampler, uint32_t device, Ptr<const Packet> packet) {
+    LinkWindow& window = sampler->Touch(device);
+    window.packets++;
+    window.bytes += packet->GetSize();
+}
+
+void TimeSeriesSampler::QueueDropped(TimeSeriesSampler *sampler, uint32_t device, Ptr<const Packet> packet) {
+    LinkWindow& window = sampler->Touch(device);
+    window.drops++;
+    window.dropBytes += packet->GetSize();
+}
+
+void TimeSeriesSampler::DiscDropped(TimeSeriesSampler *sampler, uint32_t device, Ptr<const QueueDiscItem> item) {
+    LinkWindow& window = sampler->Touch(device);
+    window.drops++;
+    window.dropBytes += item->GetSize();
+}
+
+uint32_t TimeSeriesSampler::QueuedPackets(uint32_t device) const {
+    Ptr<PointToPointNetDevice> p2p = DynamicCast<PointToPointNetDevice>(m_topology.linkDevices[device]);
+    return (p2p ? p2p->GetQueue()->GetNPackets() : 0) + (m_discs[device] ? m_discs[device]->GetNPackets() : 0);
+}
+
+void TimeSeriesSampler::Sample(void) {
+    double now = Simulator::Now().GetSeconds();
+
+    m_packets.CollectWindow(m_flowSamples);
+    for (size_t i = 0; i < m_flowSamples.size(); ++i) {
+        const FlowWindowSample& flow = m_flowSamples[i];
+        m_out << now << ",f," << flow.flow << "," << flow.packets << "," << flow.bytes << ","
+              << flow.delaySum / flow.packets * 1000 << "\n";
+    }
+
+    for (size_t i = 0; i < m_dirtyLinks.size(); ++i) {
+        uint32_t device = m_dirtyLinks[i];
+        LinkWindow& window = m_links[device];
+        uint32_t queued = QueuedPackets(device);
+        if (window.packets > 0) {
+            m_out << now << ",l," << device << "," << window.packets << "," << window.bytes << "," << queued << "\n";
+        }
+        if (window.drops > 0) {
+            m_out << now << ",d," << device << "," << window.drops << "," << window.dropBytes << "," << queued << "\n";
+        }
+        window = LinkWindow();
+    }
+    m_dirtyLinks.clear();
+
+    m_event = Simulator::Schedule(m_interval, &TimeSeriesSampler::Sample, this);
+}
+
+void TimeSeriesSampler::Finish(void) {
+    Simulator::Cancel(m_event);
+    Sample();
+    Simulator::Cancel(m_event);
+    m_out.close();
+
+    std::ofstream index((m_filename + ".index").c_str());
+    index << "kind,id,source,destination,protocol\n";
+    for (uint32_t f = 0; f < m_packets.GetNFlows(); ++f) {
+        const FlowKey& key = m_packets.GetFlowKey(f);
+        index << "f," << f << "," << Ipv4Address(key.source) << ":" << key.sourcePort << ","
+              << Ipv4Address(key.destination) << ":" << key.destinationPort << "," << (uint32_t)key.protocol << "\n";
+    }
+    for (uint32_t d = 0; d < m_topology.linkDevices.size(); ++d) {
+        const TopologyLink& link = m_topology.links[d / 2];
+        uint32_t from = d % 2 == 0 ? link.nodeA : link.nodeB;
+        uint32_t to = d % 2 == 0 ? link.nodeB : link.nodeA;
+        index << "l," << d << "," << from << "," << to << ",\n";
+    }
+}
+
+
+// Binary event tracing
+//
+// Application events are recorded as fixed-size records in a preallocated ring
+// that keeps the most recent `capacity` events; nothing is formatted while the
+// simulation runs. The ring is written once at the end and turned back into
+// text with --decodeTrace. Build with -DNETWORK_EVENT_TRACE=0 to compile the
+// trace points out; at run time they cost one null check while --trace is unset.
+// File layout, host byte order:
+//   "NTRC" u32 version u32 recordSize u64 recorded u64 stored, then `stored`
+//   EventRecords oldest first
+
+#ifndef NETWORK_EVENT_TRACE
+#define NETWORK_EVENT_TRACE 1
+#endif
+
+#if NETWORK_EVENT_TRACE
+#define TRACE_EVENT(trace, ...) do { if (trace) { (trace)->Record(__VA_ARGS__); } } while (0)
+#else
+#define TRACE_EVENT(trace, ...) do { } while (0)
+#endif
+
+enum TraceEventType : uint32_t {
+    EVENT_CLIENT_SEND = 1,      // request handed to the socket
+    EVENT_CLIENT_BACKLOG,       // request queued while every connection is full
+    EVENT_CLIENT_DROP,          // request dropped by a full backlog or socket
+    EVENT_CLIENT_RESPONSE,
+    EVENT_CLIENT_REJECTED,
+    EVENT_SERVER_ACCEPT,
+    EVENT_SERVER_REFUSE,
+    EVENT_SERVER_REQUEST,
+    EVENT_SERVER_REJECT,
+    EVENT_SERVER_RESPONSE,
+    EVENT_SERVER_CLOSE
+};
+
+static const char *TraceEventName(uint32_t type) {
+    static const char *names[] = { "unknown", "client-send", "client-backlog", "client-drop", "client-response",
+                                   "client-rejected", "server-accept", "server-refuse", "server-request",
+                                   "server-reject", "server-response", "server-close" };
+    return type < sizeof(names) / sizeof(names[0]) ? names[type] : names[0];
+}
+
+struct EventRecord {
+    int64_t time;               // simulator timesteps
+    uint32_t node;
+    uint32_t type;
+    uint32_t connection;
+    uint32_t messageId;
+    uint32_t size;              // payload bytes
+    uint32_t value;             // event specific: backlog or queue length, peer address on accept
+};
+
+class EventTrace {
+public:
+    static const uint32_t kVersion = 1;
+
+    // Capacity is rounded up to a power of two
+    explicit EventTrace(uint32_t capacity) : m_recorded(0) {
+        uint32_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        m_records.resize(size);
+        m_mask = size - 1;
+    }
+
+    void Record(uint32_t node, TraceEventType type, uint32_t connection, uint32_t messageId, uint32_t size, uint32_t value = 0) {
+        EventRecord& record = m_records[m_recorded++ & m_mask];
+        record.time = Simulator::Now().GetTimeStep();
+        record.node = node;
+        record.type = type;
+        record.connection = connection;
+        record.messageId = messageId;
+        record.size = size;
+        record.value = value;
+    }
+
+    void Write(const std::string& filename) const;
+
+private:
+    std::vector<EventRecord> m_records;
+    uint64_t m_recorded;
+    uint64_t m_mask;
+};
+
+void EventTrace::Write(const std::string& filename) const {
+    uint64_t stored = std::min<uint64_t>(m_recorded, m_records.size());
+    uint64_t first = m_recorded - stored;
+    uint32_t version = kVersion;
+    uint32_t recordSize = sizeof(EventRecord);
+    std::ofstream out(filename.c_str(), std::ios::binary);
+    out.write("NTRC", 4);
+    out.write(reinterpret_cast<const char *>(&version), sizeof(version));
+    out.write(reinterpret_cast<const char *>(&recordSize), sizeof(recordSize));
+    out.write(reinterpret_cast<const char *>(&m_recorded), sizeof(m_recorded));
+    out.write(reinterpret_cast<const char *>(&stored), sizeof(stored));
+    // Oldest record to the end of the ring, then the wrapped part
+    uint64_t begin = first & m_mask;
+    uint64_t head = std::min<uint64_t>(stored, m_records.size() - begin);
+    out.write(reinterpret_cast<const char *>(&m_records[begin]), head * sizeof(EventRecord));
+    out.write(reinterpret_cast<const char *>(&m_records[0]), (stored - head) * sizeof(EventRecord));
+}
+
+// Offline decoder: one line per record, "<seconds> <node> <event> <connection> <message> <bytes> <value>"
+int DecodeEventTrace(const std::string& filename, std::ostream& os) {
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    char magic[4];
+    uint32_t version = 0, recordSize = 0;
+    uint64_t recorded = 0, stored = 0;
+    in.read(magic, sizeof(magic));
+    in.read(reinterpret_cast<char *>(&version), sizeof(version));
+    in.read(reinterpret_cast<char *>(&recordSize), sizeof(recordSize));
+    in.read(reinterpret_cast<char *>(&recorded), sizeof(recorded));
+    in.read(reinterpret_cast<char *>(&stored), sizeof(stored));
+    if (!in || std::string(magic, 4) != "NTRC" || version != EventTrace::kVersion || recordSize != sizeof(EventRecord)) {
+        std::cerr << "Not a version " << EventTrace::kVersion << " event trace: " << filename << std::endl;
+        return 1;
+    }
+    os << "# " << recorded << " events recorded, " << stored << " kept\n";
+    os << "# time node event connection message bytes value\n";
+    std::vector<EventRecord> records(4096);
+    while (stored > 0) {
+        uint64_t count = std::min<uint64_t>(stored, records.size());
+        if (!in.read(reinterpret_cast<char *>(&records[0]), count * sizeof(EventRecord))) {
+            std::cerr << "Truncated event trace: " << filename << std::endl;
+            return 1;
+        }
+        for (uint64_t i = 0; i < count; ++i) {
+            const EventRecord& r = records[i];
+            os << TimeStep(r.time).GetSeconds() << " " << r.node << " " << TraceEventName(r.type) << " "
+               << r.connection << " " << r.messageId << " " << r.size << " " << r.value << "\n";
+        }
+        stored -= count;
+    }
+    return 0;
+}
+
+
+// Application message framing
+//
+// Every client request and server response is an AppMessageHeader followed by
+// payloadSize bytes. The header also carries the request's timeline: the client
+// stamps when the request was generated and when it entered the socket, and the
+// server echoes both along with when it received and answered the request.
+// Requests for named content carry a nonzero content id, echoed in the response.
+// TCP may split or coalesce messages, so each connection keeps a reassembly
+// buffer; messages are cut from it as packet fragments, never copied out.
+
+enum AppMessageType : uint8_t { MSG_REQUEST = 1, MSG_RESPONSE = 2, MSG_REJECT = 3 };
+
+class AppMessageHeader : public Header {
+public:
+    static const uint32_t kSize = 45;
+
+    AppMessageHeader() : m_type(MSG_REQUEST), m_payloadSize(0), m_messageId(0), m_contentId(0)
+        , m_created(0), m_sent(0), m_serverReceived(0), m_serverResponded(0) {}
+
+    static TypeId GetTypeId(void);
+    virtual TypeId GetInstanceTypeId(void) const;
+    virtual uint32_t GetSerializedSize(void) const;
+    virtual void Serialize(Buffer::Iterator start) const;
+    virtual uint32_t Deserialize(Buffer::Iterator start);
+    virtual void Print(std::ostream& os) const;
+
+    void Set(AppMessageType type, uint32_t payloadSize, uint32_t messageId) {
+        m_type = type;
+        m_payloadSize = payloadSize;
+        m_messageId = messageId;
+    }
+    AppMessageType GetType(void) const { return (AppMessageType)m_type; }
+    uint32_t GetPayloadSize(void) const { return m_payloadSize; }
+    uint32_t GetMessageId(void) const { return m_messageId; }
+    void SetContentId(uint32_t contentId) { m_contentId = contentId; }
+    uint32_t GetContentId(void) const { return m_contentId; }
+
+    void SetClientTimes(Time created, Time sent) {
+        m_created = created.GetTimeStep();
+        m_sent = sent.GetTimeStep();
+    }
+    void SetServerTimes(Time received, Time responded) {
+        m_serverReceived = received.GetTimeStep();
+        m_serverResponded = responded.GetTimeStep();
+    }
+    Time GetCreated(void) const { return TimeStep(m_created); }
+    Time GetSent(void) const { return TimeStep(m_sent); }
+    Time GetServerReceived(void) const { return TimeStep(m_serverReceived); }
+    Time GetServerResponded(void) const { return TimeStep(m_serverResponded); }
+
+private:
+    uint8_t m_type;
+    uint32_t m_payloadSize;
+    uint32_t m_messageId;
+    uint32_t m_contentId;
+    int64_t m_created;
+    int64_t m_sent;
+    int64_t m_serverReceived;
+    int64_t m_serverResponded;
+};
+
+TypeId AppMessageHeader::GetTypeId(void) {
+    static TypeId tid = TypeId("AppMessageHeader")
+        .SetParent<Header>()
+        .AddConstructor<AppMessageHeader>();
+    return tid;
+}
+NS_OBJECT_ENSURE_REGISTERED(AppMessageHeader);
+
+TypeId AppMessageHeader::GetInstanceTypeId(void) const {
+    return GetTypeId();
+}
+
+uint32_t AppMessageHeader::GetSerializedSize(void) const {
+    return kSize;
+}
+
+void AppMessageHeader::Serialize(Buffer::Iterator start) const {
+    start.WriteU8(m_type);
+    start.WriteHtonU32(m_payloadSize);
+    start.WriteHtonU32(m_messageId);
+    start.WriteHtonU32(m_contentId);
+    start.WriteHtonU64(m_created);
+    start.WriteHtonU64(m_sent);
+    start.WriteHtonU64(m_serverReceived);
+    start.WriteHtonU64(m_serverResponded);
+}
+
+uint32_t AppMessageHeader::Deserialize(Buffer::Iterator start) {
+    m_type = start.ReadU8();
+    m_payloadSize = start.ReadNtohU32();
+    m_messageId = start.ReadNtohU32();
+    m_contentId = start.ReadNtohU32();
+    m_created = start.ReadNtohU64();
+    m_sent = start.ReadNtohU64();
+    m_serverReceived = start.ReadNtohU64();
+    m_serverResponded = start.ReadNtohU64();
+    return kSize;
+}
+
+void AppMessageHeader::Print(std::ostream& os) const {
+    os << (m_type == MSG_REQUEST ? "request " : m_type == MSG_RESPONSE ? "response " : "reject ") << m_messageId << " (" << m_payloadSize << " bytes)";
+    if (m_contentId != 0) {
+        os << " content " << m_contentId;
+    }
+}
+
+// Per-connection reassembly of length-prefixed messages
+class MessageReassembler {
+public:
+    MessageReassembler() : m_buffer(Create<Packet>()) {}
+
+    void Append(Ptr<Packet> segment) { m_buffer->AddAtEnd(segment); }
+
+    // Pops the next complete message; the payload is a fragment of the received data
+    bool Next(AppMessageHeader& header, Ptr<Packet>& payload) {
+        if (m_buffer->GetSize() < AppMessageHeader::kSize) {
+            return false;
+        }
+        m_buffer->PeekHeader(header);
+        uint32_t messageSize = AppMessageHeader::kSize + header.GetPayloadSize();
+        if (m_buffer->GetSize() < messageSize) {
+            return false;
+        }
+        payload = m_buffer->CreateFragment(AppMessageHeader::kSize, header.GetPayloadSize());
+        m_buffer->RemoveAtStart(messageSize);
+        return true;
+    }
+
+    uint32_t GetBufferedBytes(void) const { return m_buffer->GetSize(); }
+
+private:
+    Ptr<Packet> m_buffer;
+};
+
+
+// Custom Client Application
+//
+// Open-loop request generator: arrivals follow the configured process whatever
+// the server does. Requests go round-robin to connections that have fewer than
+// maxOutstanding unanswered requests, and wait in a bounded backlog otherwise.
+// With contentCount set, each request names content 1..contentCount, drawn
+// with Zipf popularity by inverting the precomputed distribution.
+class CustomClient : public Application {
+private:
+    virtual void StartApplication(void);
+    virtual void StopApplication(void);
+
+    struct Connection {
+        Ptr<Socket> socket;
+        MessageReassembler reassembler;
+        uint32_t outstanding;
+    };
+
+    struct QueuedRequest {
+        uint32_t payloadSize;
+        uint32_t contentId;
+        Time created;
+    };
+
+    void SendMessage(void);
+    void HandleRead(Ptr<Socket> socket);
+    void ScheduleTransmissions(void);
+    Time NextArrivalGap(void);
+    uint32_t NextPayloadSize(void);
+    uint32_t NextContent(void);
+    // Sends on the next connection with a free pipeline slot; false if all are full
+    bool TrySend(const QueuedRequest& request);
+    Address m_peer;
+    uint32_t m_packetSize;
+    EventId m_sendEvent;
+    uint32_t m_messageCount;
+    uint32_t m_responsesReceived;
+    uint32_t m_requestsDropped;
+    uint32_t m_requestsRejected;
+    AppMessageHeader m_requestHeader;
+    double m_interval; 
+    ClientLoadConfig m_load;
+    std::vector<double> m_contentCdf;   // P(content <= i + 1)
+    std::vector<Connection> m_connections;
+    std::map<Ptr<Socket>, uint32_t> m_connectionIndex;
+    uint32_t m_nextConnection;
+    std::deque<QueuedRequest> m_backlog;
+    StreamingDelayStats m_requestLatency;
+    StreamingDelayStats m_clientQueueDelay;
+    StreamingDelayStats m_networkDelay;
+    StreamingDelayStats m_serverDelay;
+    Time m_burstEnd;
+    Ptr<ExponentialRandomVariable> m_exponential;
+    Ptr<UniformRandomVariable> m_uniform;
+    EventTrace *m_trace;
+
+public:
+    CustomClient();
+    virtual ~CustomClient();
+    void Setup(Address address, uint32_t packetSize, double interval = 1.0);
+    void SetLoad(const ClientLoadConfig& load);
+    // Records send/receive events when set
+    void SetTrace(EventTrace *trace) { m_trace = trace; }
+    // Fixes the random streams; returns the number used
+    int64_t AssignStreams(int64_t stream);
+
+    uint32_t GetRequestsSent(void) const { return m_messageCount; }
+    uint32_t GetResponsesReceived(void) const { return m_responsesReceived; }
+    uint32_t GetRequestsDropped(void) const { return m_requestsDropped; }
+    uint32_t GetRequestsRejected(void) const { return m_requestsRejected; }
+    // Generation to response arrival, and its split into client backlog, network round trip and server time
+    const StreamingDelayStats& GetRequestLatency(void) const { return m_requestLatency; }
+    const StreamingDelayStats& GetClientQueueDelay(void) const { return m_clientQueueDelay; }
+    const StreamingDelayStats& GetNetworkDelay(void) const { return m_networkDelay; }
+    const StreamingDelayStats& GetServerDelay(void) const { return m_serverDelay; }
+};
+
+CustomClient::CustomClient() : m_peer(), m_packetSize(0), m_messageCount(0)
+    , m_responsesReceived(0), m_requestsDropped(0), m_requestsRejected(0), m_interval(1), m_load(DefaultClientLoad())
+    , m_nextConnection(0), m_trace(0)  {
+    m_exponential = CreateObject<ExponentialRandomVariable>();
+    m_uniform = CreateObject<UniformRandomVariable>();
+}
+
+CustomClient::~CustomClient() {
+}
+
+void CustomClient::Setup(Address address, uint32_t packetSize, double interval) {
+    m_peer = address;
+    m_packetSize = packetSize;
+    m_interval = interval;
+}
+
+void CustomClient::SetLoad(const ClientLoadConfig& load) {
+    m_load = load;
+    m_contentCdf.resize(load.contentCount);
+    double sum = 0.0;
+    for (uint32_t i = 0; i < load.contentCount; ++i) {
+        sum += 1.0 / std::pow(i + 1.0, load.zipfExponent);
+        m_contentCdf[i] = sum;
+    }
+    for (uint32_t i = 0; i < load.contentCount; ++i) {
+        m_contentCdf[i] /= sum;
+    }
+}
+
+int64_t CustomClient::AssignStreams(int64_t stream) {
+    m_exponential->SetStream(stream);
+    m_uniform->SetStream(stream + 1);
+    return 2;
+}
+
+void CustomClient::StartApplication(void) {
+    m_connections.resize(std::max(1u, m_load.connections));
+    for (uint32_t i = 0; i < m_connections.size(); ++i) {
+        Ptr<Socket> socket = Socket::CreateSocket(GetNode(), TcpSocketFactory::GetTypeId());
+        socket->Bind();
+        socket->Connect(m_peer);
+        socket->SetRecvCallback(MakeCallback(&CustomClient::HandleRead, this));
+        m_connections[i].socket = socket;
+        m_connections[i].outstanding = 0;
+        m_connectionIndex[socket] = i;
+    }
+    m_burstEnd = Simulator::Now() + Seconds(m_exponential->GetValue(m_load.burstOn, 0));
+    ScheduleTransmissions();
+}
+
+void CustomClient::ScheduleTransmissions(void) {
+    // Schedule first transmission
+    m_sendEvent = Simulator::Schedule(Seconds(0.0), &CustomClient::SendMessage, this);
+}
+
+void CustomClient::StopApplication(void) {
+    Simulator::Cancel(m_sendEvent);
+    // Closing sockets still deliver data until FIN; nothing reads it once stopped
+    for (uint32_t i = 0; i < m_connections.size(); ++i) {
+        m_connections[i].socket->SetRecvCallback(MakeNullCallback<void, Ptr<Socket> >());
+        m_connections[i].socket->Close();
+    }
+    m_connections.clear();
+    m_connectionIndex.clear();
+    m_backlog.clear();
+}
+
+Time CustomClient::NextArrivalGap(void) {
+    double rate = m_load.rate > 0 ? m_load.rate : 1.0 / m_interval;
+    switch (m_load.arrival) {
+    case ARRIVAL_POISSON:
+        return Seconds(m_exponential->GetValue(1.0 / rate, 0));
+    case ARRIVAL_ONOFF: {
+        // Constant rate while on; exponential on and off periods
+        Time gap = Seconds(1.0 / rate);
+        if (Simulator::Now() + gap <= m_burstEnd) {
+            return gap;
+        }
+        Time off = Seconds(m_exponential->GetValue(m_load.burstOff, 0));
+        m_burstEnd = Simulator::Now() + off + Seconds(m_exponential->GetValue(m_load.burstOn, 0));
+        return off;
+    }
+    case ARRIVAL_CONSTANT:
+    default:
+        return Seconds(1.0 / rate);
+    }
+}
+
+uint32_t CustomClient::NextPayloadSize(void) {
+    switch (m_load.payload) {
+    case PAYLOAD_UNIFORM:
+        return m_uniform->GetInteger(m_load.payloadMin, m_load.payloadMax);
+    case PAYLOAD_EXPONENTIAL:
+        return std::max(1u, (uint32_t)m_exponential->GetValue(m_packetSize, m_load.payloadMax));
+    case PAYLOAD_PARETO: {
+        // Inverse transform with the scale chosen so the mean is m_packetSize
+        double scale = m_packetSize * (m_load.paretoShape - 1) / m_load.paretoShape;
+        double size = scale / std::pow(1.0 - m_uniform->GetValue(0.0, 1.0), 1.0 / m_load.paretoShape);
+        return (uint32_t)std::min<double>(size, m_load.payloadMax);
+    }
+    case PAYLOAD_FIXED:
+    default:
+        return m_packetSize;
+    }
+}
+
+uint32_t CustomClient::NextContent(void) {
+    if (m_contentCdf.empty()) {
+        return 0;
+    }
+    double u = m_uniform->GetValue(0.0, 1.0);
+    size_t rank = std::lower_bound(m_contentCdf.begin(), m_contentCdf.end(), u) - m_contentCdf.begin();
+    return std::min(rank, m_contentCdf.size() - 1) + 1;
+}
+
+bool CustomClient::TrySend(const QueuedRequest& request) {
+    uint32_t payloadSize = request.payloadSize;
+    for (uint32_t tried = 0; tried < m_connections.size(); ++tried) {
+        uint32_t index = m_nextConnection;
+        Connection& connection = m_connections[index];
+        m_nextConnection = (m_nextConnection + 1) % m_connections.size();
+        if (m_load.maxOutstanding > 0 && connection.outstanding >= m_load.maxOutstanding) {
+            continue;
+        }
+        m_messageCount++;
+        // Payload bytes are virtual zero-filled data; only the header is serialized
+        m_requestHeader.Set(MSG_REQUEST, payloadSize, m_messageCount);
+        m_requestHeader.SetContentId(request.contentId);
+        m_requestHeader.SetClientTimes(request.created, Simulator::Now());
+        Ptr<Packet> packet = Create<Packet>(payloadSize);
+        packet->AddHeader(m_requestHeader);
+        if (connection.socket->Send(packet) < 0) {
+            m_requestsDropped++;
+            TRACE_EVENT(m_trace, GetNode()->GetId(), EVENT_CLIENT_DROP, index, m_messageCount, payloadSize);
+            return true;
+        }
+        connection.outstanding++;
+        TRACE_EVENT(m_trace, GetNode()->GetId(), EVENT_CLIENT_SEND, index, m_messageCount, payloadSize, connection.outstanding);
+        return true;
+    }
+    return false;
+}
+
+void CustomClient::SendMessage(void) {
+    uint32_t payloadSize = NextPayloadSize();
+    QueuedRequest request = { payloadSize, NextContent(), Simulator::Now() };
+    if (!m_backlog.empty() || !TrySend(request)) {
+        if (m_backlog.size() < m_load.backlogLimit) {
+            m_backlog.push_back(request);
+            TRACE_EVENT(m_trace, GetNode()->GetId(), EVENT_CLIENT_BACKLOG, 0, 0, request.payloadSize, m_backlog.size());
+        } else {
+            m_requestsDropped++;
+            TRACE_EVENT(m_trace, GetNode()->GetId(), EVENT_CLIENT_DROP, 0, 0, request.payloadSize, m_backlog.size());
+        }
+    }
+      // Schedule next arrival
+    m_sendEvent = Simulator::Schedule(NextArrivalGap(), &CustomClient::SendMessage, this);           
+}
+
+void CustomClient::HandleRead(Ptr<Socket> socket) {
+    std::map<Ptr<Socket>, uint32_t>::iterator it = m_connectionIndex.find(socket);
+    if (it == m_connectionIndex.end()) {
+        return;
+    }
+    uint32_t index = it->second;
+    Connection& connection = m_connections[index];
+    Ptr<Packet> packet;
+    while ((packet = socket->Recv())) {
+        connection.reassembler.Append(packet);
+    }
+    AppMessageHeader header;
+    Ptr<Packet> payload;
+    while (connection.reassembler.Next(header, payload)) {
+        if (header.GetType() == MSG_REJECT) {
+            m_requestsRejected++;
+            TRACE_EVENT(m_trace, GetNode()->GetId(), EVENT_CLIENT_REJECTED, index, header.GetMessageId(), 0);
+        } else {
+            m_responsesReceived++;
+            Time now = Simulator::Now();
+            Time server = header.GetServerResponded() - header.GetServerReceived();
+            m_requestLatency.Add(now - header.GetCreated(), payload->GetSize());
+            m_clientQueueDelay.Add(header.GetSent() - header.GetCreated(), 0);
+            m_serverDelay.Add(server, 0);
+            m_networkDelay.Add(now - header.GetSent() - server, 0);
+            TRACE_EVENT(m_trace, GetNode()->GetId(), EVENT_CLIENT_RESPONSE, index, header.GetMessageId(), payload->GetSize());
+        }
+        if (connection.outstanding > 0) {
+            connection.outstanding--;
+        }
+    }
+    // Freed pipeline slots drain the backlog in arrival order
+    while (!m_backlog.empty() && TrySend(m_backlog.front())) {
+        m_backlog.pop_front();
+    }
+}
+
+// Custom Server Application
+//
+// Requests from all connections share one FIFO served by a fixed pool of
+// workers; each request's service time is drawn from the service model. Requests
+// arriving to a full queue are rejected, and connections beyond maxConnections
+// are refused at accept time. Named content is answered with contentSize bytes.
+class CustomServer : public Application {
+private:
+    virtual void StartApplication(void);
+    virtual void StopApplication(void);
+
+    // Compact per-connection accounting; rows outlive their sockets for reporting
+    struct Connection {
+        Ptr<Socket> socket;
+        MessageReassembler reassembler;
+        Ipv4Address peer;
+        uint64_t bytesReceived;
+        uint64_t bytesSent;
+        uint32_t requests;
+        uint32_t outstanding;
+        uint32_t rejected;
+        uint32_t started;       // requests that reached a worker, the queueDelay count
+        Time queueDelay;
+        Time serviceTime;
+        Time firstRequest;
+        Time lastResponse;
+    };
+
+    struct PendingRequest {
+        uint32_t connection;
+        uint32_t messageId;
+        uint32_t contentId;
+        Time arrival;
+        Time clientCreated;
+        Time clientSent;
+    };
+
+    bool HandleAcceptRequest(Ptr<Socket> socket, const Address& from);
+    void HandleAccept(Ptr<Socket> socket, const Address& from);
+    void HandleRead(Ptr<Socket> socket);
+    void HandleClose(Ptr<Socket> socket);
+    void StartService(void);
+    void FinishService(PendingRequest request, Time serviceTime);
+    void SendResponse(Connection& connection, AppMessageType type, uint32_t payloadSize, const PendingRequest& request);
+    Time NextServiceTime(void);
+
+    Ptr<Socket> m_socket;
+    uint16_t m_port;
+    uint32_t m_responseSize;
+    uint32_t m_messagesReceived;
+    AppMessageHeader m_responseHeader;
+    ServerServiceConfig m_service;
+    std::vector<Connection> m_connections;
+    std::map<Ptr<Socket>, uint32_t> m_connectionIndex;
+    std::deque<PendingRequest> m_queue;
+    uint32_t m_busyWorkers;
+    uint32_t m_maxQueueLength;
+    uint32_t m_acceptDrops;
+    uint32_t m_rejected;
+    Ptr<ExponentialRandomVariable> m_exponential;
+    EventTrace *m_trace;
+
+public:
+    CustomServer();
+    virtual ~CustomServer();
+    void Setup(uint16_t port, uint32_t responseSize = 64);
+    void SetService(const ServerServiceConfig& service);
+    // Records connection and request events when set
+    void SetTrace(EventTrace *trace) { m_trace = trace; }
+    // Fixes the random streams; returns the number used
+    int64_t AssignStreams(int64_t stream) { m_exponential->SetStream(stream); return 1; }
+
+    // Appends one row per connection and one per client to the given tables
+    void ExportConnections(MetricsTable& connections, MetricsTable& clients) const;
+    uint32_t GetAcceptDrops(void) const { return m_acceptDrops; }
+    uint32_t GetRejectedRequests(void) const { return m_rejected; }
+    uint32_t GetMaxQueueLength(void) const { return m_maxQueueLength; }
+    // Mean time requests that reached a worker waited for it
+    double GetMeanQueueDelay(void) const;
+};
+
+CustomServer::CustomServer() : m_socket(0), m_port(0), m_responseSize(0), m_messagesReceived(0)
+    , m_service(DefaultServerService()), m_busyWorkers(0), m_maxQueueLength(0), m_acceptDrops(0), m_rejected(0), m_trace(0)  {
+    m_exponential = CreateObject<ExponentialRandomVariable>();
+}
+
+CustomServer::~CustomServer() {
+    m_socket = 0;
+}
+
+void CustomServer::Setup(uint16_t port, uint32_t responseSize) {
+    m_port = port;
+    m_responseSize = responseSize;
+}
+
+void CustomServer::SetService(const ServerServiceConfig& service) {
+    m_service = service;
+}
+
+void CustomServer::StartApplication(void) {
+    m_socket = Socket::CreateSocket(GetNode(), TcpSocketFactory::GetTypeId());
+    InetSocketAddress local = InetSocketAddress(Ipv4Address::GetAny(), m_port);
+    m_socket->Bind(local);
+    m_socket->Listen();
+    m_socket->SetAcceptCallback(
+        MakeCallback(&CustomServer::HandleAcceptRequest, this),
+        MakeCallback(&CustomServer::HandleAccept, this));
+    NS_LOG_INFO("Server started on node " << GetNode()->GetId());
+}
+
+void CustomServer::StopApplication(void) {
+    if (m_socket) {
+        m_socket->Close();
+    }
+    // Close callbacks may fire synchronously, so iterate over a detached index
+    std::map<Ptr<Socket>, uint32_t> open;
+    open.swap(m_connectionIndex);
+    for (std::map<Ptr<Socket>, uint32_t>::iterator it = open.begin(); it != open.end(); ++it) {
+        it->first->Close();
+        m_connections[it->second].socket = 0;
+    }
+    m_queue.clear();
+}
+
+bool CustomServer::HandleAcceptRequest(Ptr<Socket>, const Address&) {
+    if (m_service.maxConnections > 0 && m_connectionIndex.size() >= m_service.maxConnections) {
+        m_acceptDrops++;
+        TRACE_EVENT(m_trace, GetNode()->GetId(), EVENT_SERVER_REFUSE, m_connections.size(), 0, 0, m_connectionIndex.size());
+        return false;
+    }
+    return true;
+}
+
+void CustomServer::HandleAccept(Ptr<Socket> socket, const Address& from) {
+    socket->SetRecvCallback(MakeCallback(&CustomServer::HandleRead, this));
+    socket->SetCloseCallbacks(MakeCallback(&CustomServer::HandleClose, this),
+                              MakeCallback(&CustomServer::HandleClose, this));
+    Connection connection;
+    connection.socket = socket;
+    connection.peer = InetSocketAddress::ConvertFrom(from).GetIpv4();
+    connection.bytesReceived = 0;
+    connection.bytesSent = 0;
+    connection.requests = 0;
+    connection.outstanding = 0;
+    connection.rejected = 0;
+    connection.started = 0;
+    m_connectionIndex[socket] = m_connections.size();
+    TRACE_EVENT(m_trace, GetNode()->GetId(), EVENT_SERVER_ACCEPT, m_connections.size(), 0, 0, connection.peer.Get());
+    m_connections.push_back(connection);
+}
+
+void CustomServer::HandleClose(Ptr<Socket> socket) {
+    std::map<Ptr<Socket>, uint32_t>::iterator it = m_connectionIndex.find(socket);
+    if (it != m_connectionIndex.end()) {
+        m_connections[it->second].socket = 0;
+        TRACE_EVENT(m_trace, GetNode()->GetId(), EVENT_SERVER_CLOSE, it->second, 0, 0);
+        m_connectionIndex.erase(it);
     }
-    
-    return std::accumulate(differences.begin(), differences.end(), 0.0) / differences.size();
 }
 
-  // Calculate bandwidth utilization
-  double CalculateBandwidthUtilization(uint64_t bytesReceived, double linkCapacity, double duration) {
-    double actualThroughput = (bytesReceived * 8.0) / duration; // bits per second
-    return (actualThroughput / (linkCapacity * 1e6)) * 100; // percentage
+void CustomServer::HandleRead(Ptr<Socket> socket) {
+    std::map<Ptr<Socket>, uint32_t>::iterator it = m_connectionIndex.find(socket);
+    if (it == m_connectionIndex.end()) {
+        return;
+    }
+    uint32_t index = it->second;
+    Connection& connection = m_connections[index];
+    Ptr<Packet> packet;
+    while ((packet = socket->Recv())) {
+        connection.bytesReceived += packet->GetSize();
+        connection.reassembler.Append(packet);
+    }
+
+    AppMessageHeader request;
+    Ptr<Packet> payload;
+    while (connection.reassembler.Next(request, payload)) {
+        m_messagesReceived++;
+        if (connection.requests++ == 0) {
+            connection.firstRequest = Simulator::Now();
+        }
+        TRACE_EVENT(m_trace, GetNode()->GetId(), EVENT_SERVER_REQUEST, index, request.GetMessageId(),
+                    request.GetPayloadSize(), m_queue.size());
+        PendingRequest pending = { index, request.GetMessageId(), request.GetContentId(), Simulator::Now(),
+                                   request.GetCreated(), request.GetSent() };
+        if (m_service.queueLimit > 0 && m_queue.size() >= m_service.queueLimit) {
+            m_rejected++;
+            connection.rejected++;
+            TRACE_EVENT(m_trace, GetNode()->GetId(), EVENT_SERVER_REJECT, index, request.GetMessageId(), 0, m_queue.size());
+            SendResponse(connection, MSG_REJECT, 0, pending);
+            continue;
+        }
+        m_queue.push_back(pending);
+        connection.outstanding++;
+        m_maxQueueLength = std::max<uint32_t>(m_maxQueueLength, m_queue.size());
+    }
+    StartService();
 }
 
+Time CustomServer::NextServiceTime(void) {
+    if (m_service.meanServiceTime <= 0) {
+        return Seconds(0);
+    }
+    if (m_service.model == SERVICE_EXPONENTIAL) {
+        return Seconds(m_exponential->GetValue(m_service.meanServiceTime, 0));
+    }
+    return Seconds(m_service.meanServiceTime);
+}
+
+void CustomServer::StartService(void) {
+    while (!m_queue.empty() && (m_service.workers == 0 || m_busyWorkers < m_service.workers)) {
+        PendingRequest request = m_queue.front();
+        m_queue.pop_front();
+        m_connections[request.connection].queueDelay += Simulator::Now() - request.arrival;
+        m_connections[request.connection].started++;
+        m_busyWorkers++;
+        Time serviceTime = NextServiceTime();
+        if (serviceTime.IsZero()) {
+            FinishService(request, serviceTime);
+        } else {
+            Simulator::Schedule(serviceTime, &CustomServer::FinishService, this, request, serviceTime);
+        }
+    }
+}
+
+void CustomServer::FinishService(PendingRequest request, Time serviceTime) {
+    m_busyWorkers--;
+    Connection& connection = m_connections[request.connection];
+    connection.serviceTime += serviceTime;
+    connection.outstanding--;
+    if (connection.socket) {
+        uint32_t responseSize = request.contentId != 0 ? m_service.contentSize : m_responseSize;
+        SendResponse(connection, MSG_RESPONSE, responseSize, request);
+        connection.lastResponse = Simulator::Now();
+        TRACE_EVENT(m_trace, GetNode()->GetId(), EVENT_SERVER_RESPONSE, request.connection, request.messageId,
+                    responseSize, m_queue.size());
+    }
+    StartService();
+}
+
+void CustomServer::SendResponse(Connection& connection, AppMessageType type, uint32_t payloadSize, const PendingRequest& request) {
+    // Echo the client's timestamps so it can split the request latency
+    m_responseHeader.Set(type, payloadSize, request.messageId);
+    m_responseHeader.SetContentId(request.contentId);
+    m_responseHeader.SetClientTimes(request.clientCreated, request.clientSent);
+    m_responseHeader.SetServerTimes(request.arrival, Simulator::Now());
+    Ptr<Packet> responsePacket = Create<Packet>(payloadSize);
+    responsePacket->AddHeader(m_responseHeader);
+    connection.bytesSent += responsePacket->GetSize();
+    connection.socket->Send(responsePacket);
+}
+
+double CustomServer::GetMeanQueueDelay(void) const {
+    Time total = Seconds(0);
+    uint64_t started = 0;
+    for (size_t i = 0; i < m_connections.size(); ++i) {
+        total += m_connections[i].queueDelay;
+        started += m_connections[i].started;
+    }
+    return started > 0 ? total.GetSeconds() / started : 0.0;
+}
+
+void CustomServer::ExportConnections(MetricsTable& connections, MetricsTable& clients) const {
+    // Per-client totals over all of a client's connections
+    std::map<Ipv4Address, std::pair<uint64_t, Time> > clientBytes;
+    std::ostringstream peer;
+    for (size_t i = 0; i < m_connections.size(); ++i) {
+        const Connection& c = m_connections[i];
+        uint32_t served = c.requests - c.rejected - c.outstanding;
+        peer.str("");
+        peer << c.peer;
+        connections.AddRow({ peer.str(), c.socket ? "open" : "closed" }, {
+            (double)i, (double)c.requests, (double)served, (double)c.rejected, (double)c.outstanding,
+            (double)c.bytesReceived, (double)c.bytesSent,
+            c.started > 0 ? c.queueDelay.GetSeconds() / c.started : 0.0,
+            served > 0 ? c.serviceTime.GetSeconds() / served : 0.0 });
+        std::pair<uint64_t, Time>& client = clientBytes[c.peer];
+        client.first += c.bytesReceived + c.bytesSent;
+        client.second = std::max(client.second, c.lastResponse - c.firstRequest);
+    }
+
+    for (std::map<Ipv4Address, std::pair<uint64_t, Time> >::const_iterator it = clientBytes.begin(); it != clientBytes.end(); ++it) {
+        double seconds = it->second.second.GetSeconds();
+        peer.str("");
+        peer << it->first;
+        clients.AddRow({ peer.str() }, { (double)it->second.first, seconds > 0 ? it->second.first * 8.0 / seconds : 0.0 });
+    }
+}
+
+
+// Edge content caching
+//
+// With --cache every department switch runs an EdgeCache, and the clients of
+// the department address their requests to it instead of the server. Requests
+// that name a content are answered from the switch on a hit; misses go to the
+// server over one pipelined origin connection, and requests for a content whose
+// fetch is already under way wait for that fetch instead of starting another.
+// Unnamed requests are relayed uncached. Capacity counts contents, whose sizes
+// the cache learns from the server's responses.
+//
+// The cache is an explicit proxy rather than a transparent one, so with caching
+// on every request passes through the switch and no run has a no-cache
+// baseline. A sweep with cache=off next to a policy measures the gain instead:
+// it compares the retrieval time the clients of every department measured with
+// the cache-off run of the same configuration (see WriteCacheComparison). The
+// replacement policies are in content_store.h.
+
+class EdgeCache : public Application {
+public:
+    EdgeCache();
+    virtual ~EdgeCache();
+    // Listens on port and fetches misses from origin
+    void Setup(uint16_t port, Address origin, const EdgeCacheConfig& config);
+
+    // Appends one row for this cache; clientRetrieval is what its clients measured
+    void Export(MetricsTable& table, const std::string& department, const StreamingDelayStats& clientRetrieval) const;
+    uint64_t GetNamedRequests(void) const { return m_hits + m_misses + m_coalesced; }
+    uint64_t GetHits(void) const { return m_hits; }
+    uint64_t GetBytesSaved(void) const { return m_bytesSaved; }
+    // Time from a named request's arrival to its answer, hits and misses
+    StreamingDelayStats GetServedTime(void) const;
 
-// Custom Client Application
-class CustomClient : public Application {
 private:
     virtual void StartApplication(void);
     virtual void StopApplication(void);
 
-    void SendMessage(void);
+    struct Connection {
+        Ptr<Socket> socket;
+        MessageReassembler reassembler;
+    };
+
+    // A client request waiting for the origin
+    struct Waiter {
+        uint32_t connection;
+        uint32_t messageId;
+        uint32_t requestBytes;
+        Time arrival;
+        Time clientCreated;
+        Time clientSent;
+    };
+
+    struct OriginFetch {
+        uint32_t content;       // 0 for a relayed unnamed request
+        std::vector<Waiter> waiters;
+    };
+
+    void HandleAccept(Ptr<Socket> socket, const Address& from);
     void HandleRead(Ptr<Socket> socket);
-    void ScheduleTransmissions(void);
+    void HandleClose(Ptr<Socket> socket);
+    void HandleOriginRead(Ptr<Socket> socket);
+    void SendToOrigin(uint32_t content, uint32_t payloadSize, const Waiter& waiter);
+    void Respond(const Waiter& waiter, AppMessageType type, uint32_t content, uint32_t payloadSize);
+
+    uint16_t m_port;
+    Address m_origin;
+    EdgeCacheConfig m_config;
+    ContentStore m_store;
     Ptr<Socket> m_socket;
-    Address m_peer;
-    uint32_t m_packetSize;
-    EventId m_sendEvent;
-    uint32_t m_messageCount;
-    std::string m_message;
-    double m_interval; 
+    Ptr<Socket> m_originSocket;
+    MessageReassembler m_originReassembler;
+    std::vector<Connection> m_connections;
+    std::map<Ptr<Socket>, uint32_t> m_connectionIndex;
+    std::unordered_map<uint32_t, uint32_t> m_fetching;      // content -> origin message id
+    std::map<uint32_t, OriginFetch> m_inflight;             // origin message id -> fetch
+    std::unordered_map<uint32_t, uint32_t> m_contentSizes;  // bytes of every content fetched
+    uint32_t m_nextOriginId;
+    AppMessageHeader m_header;
+    uint64_t m_hits;
+    uint64_t m_misses;
+    uint64_t m_coalesced;
+    uint64_t m_relayed;
+    uint64_t m_rejected;
+    uint64_t m_originBytes;     // requests and responses exchanged with the origin
+    uint64_t m_bytesSaved;      // origin traffic hits and coalesced requests did not cause
+    StreamingDelayStats m_hitTime;
+    StreamingDelayStats m_missTime;
+};
+
+EdgeCache::EdgeCache() : m_port(0), m_nextOriginId(0), m_hits(0), m_misses(0), m_coalesced(0), m_relayed(0)
+    , m_rejected(0), m_originBytes(0), m_bytesSaved(0) {
+    m_config.policy = CACHE_LRU;
+    m_config.capacity = 1;
+}
+
+EdgeCache::~EdgeCache() {
+    m_socket = 0;
+    m_originSocket = 0;
+}
+
+void EdgeCache::Setup(uint16_t port, Address origin, const EdgeCacheConfig& config) {
+    m_port = port;
+    m_origin = origin;
+    m_config = config;
+    m_store.Configure(config.policy, config.capacity);
+}
+
+void EdgeCache::StartApplication(void) {
+    m_socket = Socket::CreateSocket(GetNode(), TcpSocketFactory::GetTypeId());
+    m_socket->Bind(InetSocketAddress(Ipv4Address::GetAny(), m_port));
+    m_socket->Listen();
+    m_socket->SetAcceptCallback(MakeNullCallback<bool, Ptr<Socket>, const Address&>(),
+                                MakeCallback(&EdgeCache::HandleAccept, this));
+    // Requests sent before the handshake completes wait in the socket's buffer
+    m_originSocket = Socket::CreateSocket(GetNode(), TcpSocketFactory::GetTypeId());
+    m_originSocket->Bind();
+    m_originSocket->Connect(m_origin);
+    m_originSocket->SetRecvCallback(MakeCallback(&EdgeCache::HandleOriginRead, this));
+}
+
+void EdgeCache::StopApplication(void) {
+    if (m_socket) {
+        m_socket->Close();
+    }
+    if (m_originSocket) {
+        m_originSocket->Close();
+    }
+    std::map<Ptr<Socket>, uint32_t> open;
+    open.swap(m_connectionIndex);
+    for (std::map<Ptr<Socket>, uint32_t>::iterator it = open.begin(); it != open.end(); ++it) {
+        it->first->Close();
+        m_connections[it->second].socket = 0;
+    }
+    m_fetching.clear();
+    m_inflight.clear();
+}
+
+void EdgeCache::HandleAccept(Ptr<Socket> socket, const Address&) {
+    socket->SetRecvCallback(MakeCallback(&EdgeCache::HandleRead, this));
+    socket->SetCloseCallbacks(MakeCallback(&EdgeCache::HandleClose, this),
+                              MakeCallback(&EdgeCache::HandleClose, this));
+    Connection connection;
+    connection.socket = socket;
+    m_connectionIndex[socket] = m_connections.size();
+    m_connections.push_back(connection);
+}
+
+void EdgeCache::HandleClose(Ptr<Socket> socket) {
+    std::map<Ptr<Socket>, uint32_t>::iterator it = m_connectionIndex.find(socket);
+    if (it != m_connectionIndex.end()) {
+        m_connections[it->second].socket = 0;
+        m_connectionIndex.erase(it);
+    }
+}
+
+void EdgeCache::HandleRead(Ptr<Socket> socket) {
+    std::map<Ptr<Socket>, uint32_t>::iterator it = m_connectionIndex.find(socket);
+    if (it == m_connectionIndex.end()) {
+        return;
+    }
+    uint32_t index = it->second;
+    Ptr<Packet> packet;
+    while ((packet = socket->Recv())) {
+        m_connections[index].reassembler.Append(packet);
+    }
+
+    AppMessageHeader request;
+    Ptr<Packet> payload;
+    while (m_connections[index].reassembler.Next(request, payload)) {
+        Waiter waiter = { index, request.GetMessageId(), AppMessageHeader::kSize + request.GetPayloadSize(),
+                          Simulator::Now(), request.GetCreated(), request.GetSent() };
+        uint32_t content = request.GetContentId();
+        if (content == 0) {
+            m_relayed++;
+            SendToOrigin(0, request.GetPayloadSize(), waiter);
+        } else if (m_store.Lookup(content)) {
+            m_hits++;
+            uint32_t size = m_contentSizes[content];
+            m_bytesSaved += waiter.requestBytes + AppMessageHeader::kSize + size;
+            m_hitTime.Add(Seconds(0), size);
+            Respond(waiter, MSG_RESPONSE, content, size);
+        } else {
+            std::unordered_map<uint32_t, uint32_t>::iterator fetch = m_fetching.find(content);
+            if (fetch != m_fetching.end()) {
+                m_coalesced++;
+                m_inflight[fetch->second].waiters.push_back(waiter);
+            } else {
+                m_misses++;
+                SendToOrigin(content, request.GetPayloadSize(), waiter);
+            }
+        }
+    }
+}
+
+void EdgeCache::SendToOrigin(uint32_t content, uint32_t payloadSize, const Waiter& waiter) {
+    uint32_t id = ++m_nextOriginId;
+    OriginFetch& fetch = m_inflight[id];
+    fetch.content = content;
+    fetch.waiters.push_back(waiter);
+    if (content != 0) {
+        m_fetching[content] = id;
+    }
+    m_header.Set(MSG_REQUEST, payloadSize, id);
+    m_header.SetContentId(content);
+    m_header.SetClientTimes(waiter.arrival, Simulator::Now());
+    Ptr<Packet> packet = Create<Packet>(payloadSize);
+    packet->AddHeader(m_header);
+    uint32_t size = packet->GetSize();
+    if (m_originSocket->Send(packet) < 0) {
+        // The origin connection refused the request (closed or buffer full): reject instead of waiting forever
+        m_inflight.erase(id);
+        if (content != 0) {
+            m_fetching.erase(content);
+        }
+        m_rejected++;
+        Respond(waiter, MSG_REJECT, content, 0);
+        return;
+    }
+    m_originBytes += size;
+}
+
+void EdgeCache::HandleOriginRead(Ptr<Socket> socket) {
+    Ptr<Packet> packet;
+    while ((packet = socket->Recv())) {
+        m_originBytes += packet->GetSize();
+        m_originReassembler.Append(packet);
+    }
+
+    AppMessageHeader response;
+    Ptr<Packet> payload;
+    while (m_originReassembler.Next(response, payload)) {
+        std::map<uint32_t, OriginFetch>::iterator it = m_inflight.find(response.GetMessageId());
+        if (it == m_inflight.end()) {
+            continue;
+        }
+        OriginFetch fetch;
+        std::swap(fetch, it->second);
+        m_inflight.erase(it);
+        uint32_t size = response.GetPayloadSize();
+        if (fetch.content != 0) {
+            m_fetching.erase(fetch.content);
+            if (response.GetType() == MSG_RESPONSE) {
+                m_contentSizes[fetch.content] = size;
+                m_store.Insert(fetch.content);
+            }
+        }
+        if (response.GetType() == MSG_REJECT) {
+            m_rejected += fetch.waiters.size();
+        }
+        for (size_t w = 0; w < fetch.waiters.size(); ++w) {
+            const Waiter& waiter = fetch.waiters[w];
+            if (fetch.content != 0) {
+                m_missTime.Add(Simulator::Now() - waiter.arrival, size);
+                // Only the first waiter's request reached the origin
+                if (w > 0) {
+                    m_bytesSaved += waiter.requestBytes + AppMessageHeader::kSize + size;
+                }
+            }
+            Respond(waiter, response.GetType(), fetch.content, size);
+        }
+    }
+}
+
+void EdgeCache::Respond(const Waiter& waiter, AppMessageType type, uint32_t content, uint32_t payloadSize) {
+    Connection& connection = m_connections[waiter.connection];
+    if (!connection.socket) {
+        return;
+    }
+    // To its clients the cache is the server: server time runs from arrival at the switch
+    m_header.Set(type, payloadSize, waiter.messageId);
+    m_header.SetContentId(content);
+    m_header.SetClientTimes(waiter.clientCreated, waiter.clientSent);
+    m_header.SetServerTimes(waiter.arrival, Simulator::Now());
+    Ptr<Packet> packet = Create<Packet>(payloadSize);
+    packet->AddHeader(m_header);
+    connection.socket->Send(packet);
+}
+
+StreamingDelayStats EdgeCache::GetServedTime(void) const {
+    StreamingDelayStats served = m_hitTime;
+    served.Merge(m_missTime);
+    return served;
+}
+
+void EdgeCache::Export(MetricsTable& table, const std::string& department, const StreamingDelayStats& clientRetrieval) const {
+    static const char *policies[] = { "off", "lru", "lfu", "arc" };
+    uint64_t named = GetNamedRequests();
+    table.AddRow({ department, policies[m_config.policy] }, {
+        (double)m_config.capacity, (double)(named + m_relayed), (double)m_hits, (double)m_misses,
+        (double)m_coalesced, (double)m_relayed, (double)m_rejected,
+        named > 0 ? (double)m_hits / named : 0.0, (double)m_store.GetEvictions(),
+        (double)m_originBytes, (double)m_bytesSaved,
+        m_missTime.GetMean(), GetServedTime().GetMean(), clientRetrieval.GetMean() });
+}
+
+
+// Traffic-matrix workload
+//
+// A traffic matrix lists, per pair of departments, flow arrivals of one class:
+//   # source destination class flows/s [size=<mean bytes>] [shape=<pareto>] [duration=<s>] [deadline=<s>]
+//   Infermerie Noyau bulk 0.2 size=200000
+//   * Noyau rpc 2
+//   Noyau * voice 0.5
+// Departments are names or indices, * stands for every department. Each entry
+// is a Poisson process from the workload start; every flow goes from a random
+// host of the source department to a random host of the destination.
+//   bulk    TCP transfer of a Pareto-sized object
+//   rpc     TCP 256-byte request answered with a Pareto-sized response
+//   voice   UDP constant bit rate, 160 B every 20 ms, 150 ms deadline
+//   video   UDP constant bit rate, 1000 B every 40 ms, 400 ms deadline
+// TCP flows report their completion time, by size bucket; constant-rate flows
+// report packet delay and the share of packets lost or later than the deadline.
+
+enum FlowClass : uint8_t { FLOW_BULK, FLOW_RPC, FLOW_VOICE, FLOW_VIDEO, FLOW_CLASS_COUNT };
+
+struct FlowClassProfile {
+    const char *name;
+    double meanSize;            // bytes of a bulk object or rpc response
+    uint32_t packetSize;        // constant-rate payload bytes
+    double packetInterval;      // seconds between constant-rate packets
+    double meanDuration;        // seconds a constant-rate flow lasts
+    double deadline;            // seconds a constant-rate packet may take
+};
+
+static const FlowClassProfile kFlowClassProfiles[FLOW_CLASS_COUNT] = {
+    { "bulk", 100000, 0, 0.0, 0.0, 0.0 },
+    { "rpc", 8000, 0, 0.0, 0.0, 0.0 },
+    { "voice", 0, 160, 0.02, 5.0, 0.15 },
+    { "video", 0, 1000, 0.04, 5.0, 0.4 }
+};
+
+// Upper bounds of the flow completion time buckets, bytes
+static const double kSizeBuckets[] = { 10e3, 100e3, 1e6 };
+static const char *kSizeBucketNames[] = { "<10KB", "10KB-100KB", "100KB-1MB", ">=1MB" };
+static const uint32_t kSizeBucketCount = sizeof(kSizeBucketNames) / sizeof(kSizeBucketNames[0]);
+
+// One traffic matrix entry
+struct TrafficDemand {
+    uint32_t source;            // department, kNoDepartment for every department
+    uint32_t destination;
+    FlowClass flowClass;
+    double rate;                // flow arrivals per second
+    double meanSize;            // class profile values unless overridden
+    double paretoShape;
+    double meanDuration;
+    double deadline;
+};
+
+static uint32_t ParseDepartment(const std::string& token, const CampusTopology& topology, uint32_t line) {
+    if (token == "*") {
+        return kNoDepartment;
+    }
+    for (uint32_t d = 0; d < topology.departments.size(); ++d) {
+        if (topology.departments[d].name == token) {
+            return d;
+        }
+    }
+    char *end = 0;
+    unsigned long index = std::strtoul(token.c_str(), &end, 10);
+    if (*end != '\0' || index >= topology.departments.size()) {
+        NS_FATAL_ERROR("Traffic matrix line " << line << ": unknown department " << token);
+    }
+    return index;
+}
+
+static std::vector<TrafficDemand> LoadTrafficMatrix(const std::string& filename, const CampusTopology& topology) {
+    std::ifstream in(filename.c_str());
+    if (!in.is_open()) {
+        NS_FATAL_ERROR("Cannot open traffic matrix " << filename);
+    }
+    std::vector<TrafficDemand> demands;
+    std::string text;
+    uint32_t line = 0;
+    while (std::getline(in, text)) {
+        ++line;
+        std::string::size_type hash = text.find('#');
+        std::istringstream fields(text.substr(0, hash));
+        std::string source, destination, flowClass;
+        double rate = 0.0;
+        if (!(fields >> source)) {
+            continue;
+        }
+        if (!(fields >> destination >> flowClass >> rate) || rate <= 0) {
+            NS_FATAL_ERROR("Traffic matrix line " << line << ": expected <source> <destination> <class> <flows/s>");
+        }
+        TrafficDemand demand;
+        demand.source = ParseDepartment(source, topology, line);
+        demand.destination = ParseDepartment(destination, topology, line);
+        demand.flowClass = FLOW_CLASS_COUNT;
+        for (uint32_t c = 0; c < FLOW_CLASS_COUNT; ++c) {
+            if (flowClass == kFlowClassProfiles[c].name) {
+                demand.flowClass = (FlowClass)c;
+            }
+        }
+        if (demand.flowClass == FLOW_CLASS_COUNT) {
+            NS_FATAL_ERROR("Traffic matrix line " << line << ": unknown flow class " << flowClass);
+        }
+        const FlowClassProfile& profile = kFlowClassProfiles[demand.flowClass];
+        demand.rate = rate;
+        demand.meanSize = profile.meanSize;
+        demand.paretoShape = 1.2;
+        demand.meanDuration = profile.meanDuration;
+        demand.deadline = profile.deadline;
+        std::string option;
+        while (fields >> option) {
+            std::string::size_type equals = option.find('=');
+            std::string key = option.substr(0, equals);
+            double value = equals == std::string::npos ? 0.0 : std::atof(option.c_str() + equals + 1);
+            if (key == "size") {
+                demand.meanSize = value;
+            } else if (key == "shape") {
+                demand.paretoShape = value;
+            } else if (key == "duration") {
+                demand.meanDuration = value;
+            } else if (key == "deadline") {
+                demand.deadline = value;
+            } else {
+                NS_FATAL_ERROR("Traffic matrix line " << line << ": unknown option " << option);
+            }
+            if (value <= 0) {
+                NS_FATAL_ERROR("Traffic matrix line " << line << ": " << key << " must be positive");
+            }
+        }
+        if (demand.paretoShape <= 1.0) {
+            NS_FATAL_ERROR("Traffic matrix line " << line << ": pareto shape must be above 1 for a finite mean");
+        }
+        demands.push_back(demand);
+    }
+    return demands;
+}
 
+class WorkloadEngine {
 public:
-    CustomClient();
-    virtual ~CustomClient();
-    void Setup(Address address, uint32_t packetSize);
+    WorkloadEngine(const CampusTopology& topology, const std::vector<TrafficDemand>& demands);
+
+    int64_t AssignStreams(int64_t stream);
+    // Opens the receivers on the destination hosts and starts every demand's arrivals; none after stop
+    void Start(Time start, Time stop);
+
+    // Per class, and per class and size bucket for TCP completion times; sums into the run metrics
+    void Export(MetricsTable& classes, MetricsTable& buckets, NetworkMetrics& metrics) const;
+
+private:
+    struct Flow {
+        FlowClass flowClass;
+        uint32_t demand;
+        uint64_t size;              // bytes delivered to the receiver: bulk object, rpc response
+        uint64_t received;
+        Time start;
+        Time finish;                // zero until complete
+        uint32_t packets;           // constant-rate packets to send
+        uint32_t packetsSent;
+        uint32_t packetsReceived;
+        uint32_t packetsOnTime;
+        Ptr<Socket> socket;         // source side of a TCP flow until it completes
+    };
+
+    // An accepted connection: flow id first, then the flow's bytes
+    struct Stream {
+        uint32_t flow;
+        uint8_t header[4];
+        uint32_t headerBytes;
+        uint64_t received;
+    };
+
+    void NextArrival(uint32_t demand);
+    uint32_t RandomHost(uint32_t department);
+    void StartFlow(uint32_t demand);
+    // Queues bytes behind what the socket still has to send
+    void Write(Ptr<Socket> socket, uint64_t bytes);
+    void Pump(Ptr<Socket> socket, uint32_t available);
+    void Connected(Ptr<Socket> socket);
+    void ConnectFailed(Ptr<Socket> socket);
+    void Accept(Ptr<Socket> socket, const Address& from);
+    void StreamClosed(Ptr<Socket> socket);
+    void ReceiveStream(Ptr<Socket> socket);
+    void ReceiveResponse(Ptr<Socket> socket);
+    void SendDatagram(uint32_t flow, Ptr<Socket> socket);
+    void ReceiveDatagram(Ptr<Socket> socket);
+    void Complete(uint32_t flow);
+
+    static const uint16_t kStreamPort = 9000;
+    static const uint16_t kDatagramPort = 9001;
+    static const uint32_t kRequestBytes = 256;
+
+    const CampusTopology& m_topology;
+    std::vector<TrafficDemand> m_demands;
+    std::vector<std::vector<uint32_t> > m_hosts;    // per department
+    Time m_stop;
+    Ptr<ExponentialRandomVariable> m_exponential;
+    Ptr<UniformRandomVariable> m_uniform;
+    std::vector<Flow> m_flows;
+    std::vector<Ptr<Socket> > m_listeners;
+    std::map<Ptr<Socket>, uint32_t> m_senders;      // source side of TCP flows
+    std::map<Ptr<Socket>, uint64_t> m_unsent;
+    std::map<Ptr<Socket>, Stream> m_streams;        // destination side
+    StreamingDelayStats m_packetDelay[FLOW_CLASS_COUNT];
 };
 
-CustomClient::CustomClient() : m_socket(0), m_peer(), m_packetSize(0), m_messageCount(0)
-    , m_interval(1)  {
-	m_message = "Message from client: Hello Server!";
+WorkloadEngine::WorkloadEngine(const CampusTopology& topology, const std::vector<TrafficDemand>& demands)
+    : m_topology(topology), m_demands(demands), m_hosts(topology.departments.size()) {
+    m_exponential = CreateObject<ExponentialRandomVariable>();
+    m_uniform = CreateObject<UniformRandomVariable>();
+    for (uint32_t id = 0; id < topology.GetNNodes(); ++id) {
+        if (topology.nodeInfo[id].role == ROLE_HOST) {
+            m_hosts[topology.nodeInfo[id].department].push_back(id);
+        }
+    }
 }
 
-CustomClient::~CustomClient() {
-    m_socket = 0;
+int64_t WorkloadEngine::AssignStreams(int64_t stream) {
+    m_exponential->SetStream(stream);
+    m_uniform->SetStream(stream + 1);
+    return 2;
+}
+
+void WorkloadEngine::Start(Time start, Time stop) {
+    m_stop = stop;
+    std::vector<bool> destination(m_topology.departments.size(), false);
+    for (uint32_t d = 0; d < m_demands.size(); ++d) {
+        for (uint32_t department = 0; department < destination.size(); ++department) {
+            destination[department] = destination[department] || m_demands[d].destination == kNoDepartment
+                                      || m_demands[d].destination == department;
+        }
+    }
+    for (uint32_t department = 0; department < destination.size(); ++department) {
+        for (size_t h = 0; destination[department] && h < m_hosts[department].size(); ++h) {
+            Ptr<Node> node = m_topology.GetNode(m_hosts[department][h]);
+            Ptr<Socket> stream = Socket::CreateSocket(node, TcpSocketFactory::GetTypeId());
+            stream->Bind(InetSocketAddress(Ipv4Address::GetAny(), kStreamPort));
+            stream->Listen();
+            stream->SetAcceptCallback(MakeNullCallback<bool, Ptr<Socket>, const Address&>(),
+                                      MakeCallback(&WorkloadEngine::Accept, this));
+            Ptr<Socket> datagram = Socket::CreateSocket(node, UdpSocketFactory::GetTypeId());
+            datagram->Bind(InetSocketAddress(Ipv4Address::GetAny(), kDatagramPort));
+            datagram->SetRecvCallback(MakeCallback(&WorkloadEngine::ReceiveDatagram, this));
+            m_listeners.push_back(stream);
+            m_listeners.push_back(datagram);
+        }
+    }
+    // Staggered: every demand's first flow comes one random interarrival after start
+    for (uint32_t d = 0; d < m_demands.size(); ++d) {
+        Simulator::Schedule(start, &WorkloadEngine::NextArrival, this, d);
+    }
+}
+
+void WorkloadEngine::NextArrival(uint32_t demand) {
+    Time next = Seconds(m_exponential->GetValue(1.0 / m_demands[demand].rate, 0));
+    if (Simulator::Now() + next < m_stop) {
+        Simulator::Schedule(next, &WorkloadEngine::StartFlow, this, demand);
+    }
+}
+
+uint32_t WorkloadEngine::RandomHost(uint32_t department) {
+    std::vector<uint32_t> candidates;
+    const std::vector<uint32_t>& hosts = department == kNoDepartment ? candidates : m_hosts[department];
+    if (department == kNoDepartment) {
+        for (size_t d = 0; d < m_hosts.size(); ++d) {
+            candidates.insert(candidates.end(), m_hosts[d].begin(), m_hosts[d].end());
+        }
+    }
+    return hosts.empty() ? kNoNode : hosts[m_uniform->GetInteger(0, hosts.size() - 1)];
+}
+
+void WorkloadEngine::StartFlow(uint32_t demand) {
+    NextArrival(demand);
+    const TrafficDemand& entry = m_demands[demand];
+    uint32_t source = RandomHost(entry.source);
+    uint32_t destination = RandomHost(entry.destination);
+    if (source == kNoNode || destination == kNoNode || source == destination) {
+        return;
+    }
+
+    uint32_t id = m_flows.size();
+    Flow flow = { entry.flowClass, demand, 0, 0, Simulator::Now(), Time(), 0, 0, 0, 0, 0 };
+    const FlowClassProfile& profile = kFlowClassProfiles[entry.flowClass];
+    Ptr<Node> node = m_topology.GetNode(source);
+    Ipv4Address address = m_topology.GetNodeAddress(destination);
+    if (entry.flowClass == FLOW_BULK || entry.flowClass == FLOW_RPC) {
+        // Inverse transform with the scale chosen so the mean is meanSize, capped at 100 means
+        double scale = entry.meanSize * (entry.paretoShape - 1) / entry.paretoShape;
+        double size = scale / std::pow(1.0 - m_uniform->GetValue(0.0, 1.0), 1.0 / entry.paretoShape);
+        flow.size = std::max<uint64_t>(1, (uint64_t)std::min(size, 100 * entry.meanSize));
+        flow.socket = Socket::CreateSocket(node, TcpSocketFactory::GetTypeId());
+        m_flows.push_back(flow);
+        Ptr<Socket> socket = flow.socket;
+        m_senders[socket] = id;
+        socket->Bind();
+        socket->SetConnectCallback(MakeCallback(&WorkloadEngine::Connected, this),
+                                   MakeCallback(&WorkloadEngine::ConnectFailed, this));
+        socket->SetSendCallback(MakeCallback(&WorkloadEngine::Pump, this));
+        socket->SetRecvCallback(MakeCallback(&WorkloadEngine::ReceiveResponse, this));
+        socket->Connect(InetSocketAddress(address, kStreamPort));
+    } else {
+        double duration = m_exponential->GetValue(entry.meanDuration, 0);
+        flow.packets = std::max(1u, (uint32_t)(duration / profile.packetInterval));
+        m_flows.push_back(flow);
+        Ptr<Socket> socket = Socket::CreateSocket(node, UdpSocketFactory::GetTypeId());
+        socket->Bind();
+        socket->Connect(InetSocketAddress(address, kDatagramPort));
+        SendDatagram(id, socket);
+    }
+}
+
+void WorkloadEngine::Write(Ptr<Socket> socket, uint64_t bytes) {
+    m_unsent[socket] += bytes;
+    Pump(socket, socket->GetTxAvailable());
+}
+
+void WorkloadEngine::Pump(Ptr<Socket> socket, uint32_t) {
+    std::map<Ptr<Socket>, uint64_t>::iterator it = m_unsent.find(socket);
+    while (it != m_unsent.end() && it->second > 0 && socket->GetTxAvailable() > 0) {
+        uint32_t chunk = std::min<uint64_t>(it->second, std::min(socket->GetTxAvailable(), 16384u));
+        if (socket->Send(Create<Packet>(chunk)) < 0) {
+            break;
+        }
+        it->second -= chunk;
+    }
+}
+
+void WorkloadEngine::Connected(Ptr<Socket> socket) {
+    uint32_t id = m_senders[socket];
+    uint8_t header[4] = { (uint8_t)(id >> 24), (uint8_t)(id >> 16), (uint8_t)(id >> 8), (uint8_t)id };
+    socket->Send(Create<Packet>(header, sizeof(header)));
+    const Flow& flow = m_flows[id];
+    Write(socket, flow.flowClass == FLOW_BULK ? flow.size : kRequestBytes);
+}
+
+void WorkloadEngine::ConnectFailed(Ptr<Socket> socket) {
+    m_senders.erase(socket);
+    m_unsent.erase(socket);
+}
+
+void WorkloadEngine::Accept(Ptr<Socket> socket, const Address&) {
+    Stream stream = { 0, { 0, 0, 0, 0 }, 0, 0 };
+    m_streams[socket] = stream;
+    socket->SetRecvCallback(MakeCallback(&WorkloadEngine::ReceiveStream, this));
+    socket->SetSendCallback(MakeCallback(&WorkloadEngine::Pump, this));
+    socket->SetCloseCallbacks(MakeCallback(&WorkloadEngine::StreamClosed, this),
+                              MakeCallback(&WorkloadEngine::StreamClosed, this));
+}
+
+void WorkloadEngine::StreamClosed(Ptr<Socket> socket) {
+    m_streams.erase(socket);
+    m_unsent.erase(socket);
+}
+
+void WorkloadEngine::ReceiveStream(Ptr<Socket> socket) {
+    std::map<Ptr<Socket>, Stream>::iterator it = m_streams.find(socket);
+    if (it == m_streams.end()) {
+        return;
+    }
+    Stream& stream = it->second;
+    Ptr<Packet> packet;
+    while ((packet = socket->Recv())) {
+        uint32_t bytes = packet->GetSize();
+        uint32_t headerPart = std::min(bytes, 4 - stream.headerBytes);
+        if (headerPart > 0) {
+            packet->CopyData(stream.header + stream.headerBytes, headerPart);
+            stream.headerBytes += headerPart;
+            if (stream.headerBytes == 4) {
+                stream.flow = (uint32_t)stream.header[0] << 24 | (uint32_t)stream.header[1] << 16
+                              | (uint32_t)stream.header[2] << 8 | stream.header[3];
+            }
+        }
+        stream.received += bytes - headerPart;
+    }
+    // Data on the workload port that does not start with a known flow id is ignored
+    if (stream.headerBytes < 4 || stream.flow >= m_flows.size()) {
+        return;
+    }
+    Flow& flow = m_flows[stream.flow];
+    if (flow.flowClass == FLOW_BULK) {
+        flow.received = stream.received;
+        if (flow.received >= flow.size && flow.finish.IsZero()) {
+            Complete(stream.flow);
+        }
+    } else if (stream.received >= kRequestBytes && m_unsent.find(socket) == m_unsent.end()) {
+        Write(socket, flow.size);
+    }
+}
+
+void WorkloadEngine::ReceiveResponse(Ptr<Socket> socket) {
+    std::map<Ptr<Socket>, uint32_t>::iterator it = m_senders.find(socket);
+    if (it == m_senders.end()) {
+        return;
+    }
+    Flow& flow = m_flows[it->second];
+    Ptr<Packet> packet;
+    while ((packet = socket->Recv())) {
+        flow.received += packet->GetSize();
+    }
+    if (flow.flowClass == FLOW_RPC && flow.received >= flow.size && flow.finish.IsZero()) {
+        Complete(it->second);
+    }
+}
+
+void WorkloadEngine::Complete(uint32_t id) {
+    Flow& flow = m_flows[id];
+    flow.finish = Simulator::Now();
+    // The source closes; the destination side goes when the close reaches it
+    m_senders.erase(flow.socket);
+    m_unsent.erase(flow.socket);
+    flow.socket->Close();
+    flow.socket = 0;
+}
+
+void WorkloadEngine::SendDatagram(uint32_t id, Ptr<Socket> socket) {
+    Flow& flow = m_flows[id];
+    const FlowClassProfile& profile = kFlowClassProfiles[flow.flowClass];
+    uint32_t sequence = flow.packetsSent++;
+    uint8_t payload[8] = { (uint8_t)(id >> 24), (uint8_t)(id >> 16), (uint8_t)(id >> 8), (uint8_t)id,
+                           (uint8_t)(sequence >> 24), (uint8_t)(sequence >> 16), (uint8_t)(sequence >> 8), (uint8_t)sequence };
+    Ptr<Packet> packet = Create<Packet>(payload, sizeof(payload));
+    packet->AddPaddingAtEnd(profile.packetSize - sizeof(payload));
+    socket->Send(packet);
+    if (flow.packetsSent < flow.packets && Simulator::Now() + Seconds(profile.packetInterval) < m_stop) {
+        Simulator::Schedule(Seconds(profile.packetInterval), &WorkloadEngine::SendDatagram, this, id, socket);
+    } else {
+        socket->Close();
+    }
+}
+
+void WorkloadEngine::ReceiveDatagram(Ptr<Socket> socket) {
+    Ptr<Packet> packet;
+    while ((packet = socket->Recv())) {
+        uint8_t payload[8];
+        if (packet->CopyData(payload, sizeof(payload)) < sizeof(payload)) {
+            continue;
+        }
+        uint32_t id = (uint32_t)payload[0] << 24 | (uint32_t)payload[1] << 16 | (uint32_t)payload[2] << 8 | payload[3];
+        uint32_t sequence = (uint32_t)payload[4] << 24 | (uint32_t)payload[5] << 16 | (uint32_t)payload[6] << 8 | payload[7];
+        if (id >= m_flows.size()) {
+            continue;
+        }
+        Flow& flow = m_flows[id];
+        // Packets leave on a fixed schedule, so the send time follows from the sequence number
+        const FlowClassProfile& profile = kFlowClassProfiles[flow.flowClass];
+        Time delay = Simulator::Now() - flow.start - Seconds(sequence * profile.packetInterval);
+        flow.packetsReceived++;
+        flow.received += packet->GetSize();
+        m_packetDelay[flow.flowClass].Add(delay, packet->GetSize());
+        if (delay.GetSeconds() <= m_demands[flow.demand].deadline) {
+            flow.packetsOnTime++;
+        }
+    }
+}
+
+void WorkloadEngine::Export(MetricsTable& classes, MetricsTable& buckets, NetworkMetrics& metrics) const {
+    StreamingDelayStats completion[FLOW_CLASS_COUNT];
+    StreamingDelayStats bucketCompletion[FLOW_CLASS_COUNT][kSizeBucketCount];
+    uint32_t flows[FLOW_CLASS_COUNT] = {}, completed[FLOW_CLASS_COUNT] = {};
+    uint32_t bucketFlows[FLOW_CLASS_COUNT][kSizeBucketCount] = {};
+    uint64_t bytes[FLOW_CLASS_COUNT] = {}, sent[FLOW_CLASS_COUNT] = {}, received[FLOW_CLASS_COUNT] = {}, onTime[FLOW_CLASS_COUNT] = {};
+    for (size_t f = 0; f < m_flows.size(); ++f) {
+        const Flow& flow = m_flows[f];
+        uint32_t c = flow.flowClass;
+        flows[c]++;
+        bytes[c] += flow.received;
+        if (c == FLOW_VOICE || c == FLOW_VIDEO) {
+            sent[c] += flow.packetsSent;
+            received[c] += flow.packetsReceived;
+            onTime[c] += flow.packetsOnTime;
+            continue;
+        }
+        uint32_t bucket = std::upper_bound(kSizeBuckets, kSizeBuckets + kSizeBucketCount - 1, (double)flow.size) - kSizeBuckets;
+        bucketFlows[c][bucket]++;
+        if (!flow.finish.IsZero()) {
+            completed[c]++;
+            completion[c].Add(flow.finish - flow.start, flow.size);
+            bucketCompletion[c][bucket].Add(flow.finish - flow.start, flow.size);
+        }
+    }
+
+    uint32_t tcpFlows = 0, tcpCompleted = 0;
+    uint64_t cbrSent = 0, cbrOnTime = 0;
+    StreamingDelayStats tcpCompletion;
+    for (uint32_t c = 0; c < FLOW_CLASS_COUNT; ++c) {
+        if (flows[c] == 0) {
+            continue;
+        }
+        const char *name = kFlowClassProfiles[c].name;
+        classes.AddRow({ name }, {
+            (double)flows[c], (double)completed[c], (double)bytes[c],
+            completion[c].GetMean(), completion[c].GetQuantile(0.5), completion[c].GetQuantile(0.99),
+            (double)sent[c], (double)received[c], sent[c] > 0 ? 1.0 - (double)onTime[c] / sent[c] : 0.0,
+            m_packetDelay[c].GetMean(), m_packetDelay[c].GetQuantile(0.99) });
+        for (uint32_t b = 0; b < kSizeBucketCount && (c == FLOW_BULK || c == FLOW_RPC); ++b) {
+            if (bucketFlows[c][b] == 0) {
+                continue;
+            }
+            const StreamingDelayStats& fct = bucketCompletion[c][b];
+            buckets.AddRow({ name, kSizeBucketNames[b] }, {
+                (double)bucketFlows[c][b], (double)fct.GetCount(), fct.GetMean(), fct.GetQuantile(0.5), fct.GetQuantile(0.99) });
+        }
+        if (c == FLOW_BULK || c == FLOW_RPC) {
+            tcpFlows += flows[c];
+            tcpCompleted += completed[c];
+            tcpCompletion.Merge(completion[c]);
+        }
+        cbrSent += sent[c];
+        cbrOnTime += onTime[c];
+    }
+    metrics.workloadFlows = m_flows.size();
+    metrics.workloadCompletedRatio = tcpFlows > 0 ? (double)tcpCompleted / tcpFlows : 0.0;
+    metrics.workloadFctP99 = tcpCompletion.GetQuantile(0.99);
+    metrics.workloadDeadlineMissRatio = cbrSent > 0 ? 1.0 - (double)cbrOnTime / cbrSent : 0.0;
+}
+
+
+// Congestion control and queue disciplines
+//
+// Every TCP socket of a run uses the configured congestion control. Backbone
+// links (department and core switches, both directions) can replace the default
+// pfifo_fast queue disc with another discipline; their device queues are then
+// cut to one packet so that the backlog builds in the queue disc, where the AQM
+// acts on it. DCTCP needs ECN: its runs negotiate ECN and the AQMs mark instead
+// of dropping. RED is then set up the DCTCP way, marking on the instantaneous
+// queue from a small threshold K and never hard-dropping above it. CoDel, FQ-CoDel
+// and PIE keep their own delay targets, so DCTCP behind them is not DCTCP as
+// deployed.
+
+static const char *kTcpVariants[] = {
+    "NewReno", "LinuxReno", "Cubic", "Bbr", "Dctcp", "Vegas", "WestwoodPlus", "Hybla", "Htcp",
+    "HighSpeed", "Scalable", "Veno", "Bic", "Yeah", "Illinois", "Lp", "Ledbat"
+};
+
+// Canonical variant name for a case-insensitive one ("cubic" -> "Cubic")
+static std::string ParseTcpVariant(const std::string& name) {
+    std::string lower(name);
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    for (size_t v = 0; v < sizeof(kTcpVariants) / sizeof(kTcpVariants[0]); ++v) {
+        std::string variant(kTcpVariants[v]);
+        std::transform(variant.begin(), variant.end(), variant.begin(), ::tolower);
+        if (variant == lower) {
+            return kTcpVariants[v];
+        }
+    }
+    NS_FATAL_ERROR("Unknown TCP variant " << name);
+    return "";
+}
+
+// ns-3 type of a queue disc name, empty for the traffic-control default
+static std::string QueueDiscTypeName(const std::string& name) {
+    if (name.empty() || name == "default") {
+        return "";
+    } else if (name == "fifo" || name == "pfifo") {
+        return "ns3::FifoQueueDisc";
+    } else if (name == "codel") {
+        return "ns3::CoDelQueueDisc";
+    } else if (name == "fqcodel") {
+        return "ns3::FqCoDelQueueDisc";
+    } else if (name == "red") {
+        return "ns3::RedQueueDisc";
+    } else if (name == "pie") {
+        return "ns3::PieQueueDisc";
+    }
+    NS_FATAL_ERROR("Unknown queue disc " << name);
+    return "";
+}
+
+// Attribute defaults read when the TCP stacks and queue discs are created
+static void ConfigureTransport(const ScenarioConfig& config) {
+    TypeId tcp;
+    NS_ABORT_MSG_IF(!TypeId::LookupByNameFailSafe("ns3::Tcp" + config.tcpVariant, &tcp),
+                    "TCP variant " << config.tcpVariant << " is not available in this ns-3 build");
+    Config::SetDefault("ns3::TcpL4Protocol::SocketType", TypeIdValue(tcp));
+    bool ecn = config.tcpVariant == "Dctcp";
+    Config::SetDefault("ns3::TcpSocketBase::UseEcn", StringValue(ecn ? "On" : "Off"));
+    Config::SetDefault("ns3::CoDelQueueDisc::UseEcn", BooleanValue(ecn));
+    Config::SetDefault("ns3::FqCoDelQueueDisc::UseEcn", BooleanValue(ecn));
+    Config::SetDefault("ns3::RedQueueDisc::UseEcn", BooleanValue(ecn));
+    if (ecn) {
+        // K = 5 packets, with the whole ramp below the default 25-packet limit
+        Config::SetDefault("ns3::RedQueueDisc::QW", DoubleValue(1.0));
+        Config::SetDefault("ns3::RedQueueDisc::MinTh", DoubleValue(5));
+        Config::SetDefault("ns3::RedQueueDisc::MaxTh", DoubleValue(15));
+        Config::SetDefault("ns3::RedQueueDisc::UseHardDrop", BooleanValue(false));
+    }
+    Config::SetDefault("ns3::PieQueueDisc::UseEcn", BooleanValue(ecn));
+}
+
+static void InstallBackboneQueueDiscs(const CampusTopology& topology, const std::string& queueDisc) {
+    std::string typeName = QueueDiscTypeName(queueDisc);
+    if (typeName.empty()) {
+        return;
+    }
+    TrafficControlHelper tch;
+    tch.SetRootQueueDisc(typeName);
+    for (uint32_t d = 0; d < topology.linkDevices.size(); ++d) {
+        const TopologyLink& link = topology.links[d / 2];
+        if (topology.nodeInfo[link.nodeA].role == ROLE_HOST || topology.nodeInfo[link.nodeB].role == ROLE_HOST) {
+            continue;
+        }
+        Ptr<NetDevice> device = topology.linkDevices[d];
+        tch.Uninstall(device);
+        tch.Install(device);
+        Ptr<PointToPointNetDevice> p2p = DynamicCast<PointToPointNetDevice>(device);
+        if (p2p) {
+            p2p->GetQueue()->SetMaxSize(QueueSize("1p"));
+        }
+    }
 }
 
-void CustomClient::Setup(Address address, uint32_t packetSize) {
-    m_peer = address;
-    m_packetSize = packetSize;
+
+// Department traffic matrix
+//
+// The statistics pass folds every monitored flow, whichever its direction, into
+// a department x department matrix: rows are source departments, columns
+// destinations, and the core switches share one extra row and column. Endpoints
+// are classified through the topology's prefix table, so the pass is linear in
+// the flows and only flows still waiting for their reverse direction are held.
+// A flow and its reverse form a conversation, counted in the cell of the
+// direction seen first, with the two directions' mean delays as its round trip.
+// Flows that never see their reverse (UDP streams, unanswered requests) are
+// reported as one-way.
+
+// Totals of one flow direction
+struct FlowSample {
+    uint64_t txPackets;
+    uint64_t rxPackets;
+    uint64_t lostPackets;
+    uint64_t rxBytes;
+    double delaySum;            // seconds, over the received packets
+    double duration;            // first transmission to last reception, seconds
+};
+
+class DepartmentFlowMatrix {
+public:
+    explicit DepartmentFlowMatrix(const CampusTopology& topology);
+
+    void Add(const FlowKey& key, const FlowSample& sample);
+    // Counts the flows left unpaired as one-way; call once every flow was added
+    void Finish(void);
+    // One row per department pair that exchanged traffic
+    void Export(MetricsTable& table) const;
+
+private:
+    struct Cell {
+        double flows;
+        double conversations;
+        double oneWay;
+        double txPackets;
+        double rxPackets;
+        double lostPackets;
+        double rxBytes;
+        double delaySum;
+        double throughput;      // sum of the flows' delivery rates, bytes per second
+        double rttSum;          // over the conversations
+    };
+
+    // First direction of a conversation, waiting for its reverse
+    struct OpenFlow {
+        uint32_t cell;
+        double meanDelay;
+    };
+
+    uint32_t GetIndex(Ipv4Address address) const;
+
+    const CampusTopology& m_topology;
+    uint32_t m_size;            // departments, then the core switches
+    std::vector<Cell> m_cells;  // row-major, source x destination
+    std::unordered_map<FlowKey, OpenFlow, FlowKeyHash> m_open;  // keyed by the awaited reverse direction
+};
+
+DepartmentFlowMatrix::DepartmentFlowMatrix(const CampusTopology& topology)
+    : m_topology(topology), m_size(topology.departments.size() + 1) {
+    Cell empty = Cell();
+    m_cells.assign(m_size * m_size, empty);
 }
 
-void CustomClient::StartApplication(void) {
-    m_socket = Socket::CreateSocket(GetNode(), TcpSocketFactory::GetTypeId());
-    m_socket->Bind();
-    m_socket->Connect(m_peer);
-    m_socket->SetRecvCallback(MakeCallback(&CustomClient::HandleRead, this));
-    //SendMessage();
-    ScheduleTransmissions();
+uint32_t DepartmentFlowMatrix::GetIndex(Ipv4Address address) const {
+    uint32_t department = m_topology.FindDepartment(address);
+    return department == kNoDepartment ? m_size - 1 : department;
 }
 
-void CustomClient::ScheduleTransmissions(void) {
-    // Schedule first transmission
-    Simulator::Schedule(Seconds(0.0), &CustomClient::SendMessage, this);
-}
+void DepartmentFlowMatrix::Add(const FlowKey& key, const FlowSample& sample) {
+    uint32_t index = GetIndex(Ipv4Address(key.source)) * m_size + GetIndex(Ipv4Address(key.destination));
+    Cell& cell = m_cells[index];
+    cell.flows++;
+    cell.txPackets += sample.txPackets;
+    cell.rxPackets += sample.rxPackets;
+    cell.lostPackets += sample.lostPackets;
+    cell.rxBytes += sample.rxBytes;
+    cell.delaySum += sample.delaySum;
+    if (sample.duration > 0) {
+        cell.throughput += sample.rxBytes / sample.duration;
+    }
 
-void CustomClient::StopApplication(void) {
-    if (m_socket) {
-        m_socket->Close();
+    double meanDelay = sample.rxPackets > 0 ? sample.delaySum / sample.rxPackets : 0.0;
+    std::unordered_map<FlowKey, OpenFlow, FlowKeyHash>::iterator it = m_open.find(key);
+    if (it != m_open.end()) {
+        Cell& first = m_cells[it->second.cell];
+        first.conversations++;
+        first.rttSum += it->second.meanDelay + meanDelay;
+        m_open.erase(it);
+        return;
     }
+    FlowKey reverse = { key.destination, key.source, key.destinationPort, key.sourcePort, key.protocol };
+    OpenFlow open = { index, meanDelay };
+    m_open[reverse] = open;
 }
 
-void CustomClient::SendMessage(void) {
-    m_messageCount++;
-    std::string message = "Hello from client i need !";
-    // Add message number to the base message
-    std::string numbered_message = m_message + " [" + std::to_string(m_messageCount) + "]";
-    Ptr<Packet> packet = Create<Packet>((uint8_t*) message.c_str(), message.length());
-    m_socket->Send(packet);
-    //NS_LOG_INFO("Client " << GetNode()->GetId() << " sent: " << message);
-     NS_LOG_INFO("Client " << GetNode()->GetId() 
-                << " sent message " << m_messageCount 
-                << " at time " << Simulator::Now().GetSeconds() 
-                << "s: " << numbered_message);
-      // Schedule next transmission if still running
-    m_sendEvent = Simulator::Schedule(Seconds(m_interval), &CustomClient::SendMessage, this);           
+void DepartmentFlowMatrix::Finish(void) {
+    for (std::unordered_map<FlowKey, OpenFlow, FlowKeyHash>::const_iterator it = m_open.begin(); it != m_open.end(); ++it) {
+        m_cells[it->second.cell].oneWay++;
+    }
+    m_open.clear();
 }
 
-void CustomClient::HandleRead(Ptr<Socket> socket) {
-    Ptr<Packet> packet;
-    Address from;
-    while ((packet = socket->RecvFrom(from))) {
-        uint8_t buffer[1024];
-        packet->CopyData(buffer, packet->GetSize());
-        std::string received = std::string((char*)buffer, packet->GetSize());
-        //NS_LOG_INFO("Client " << GetNode()->GetId() << " received: " << received);
-        NS_LOG_INFO("Client " << GetNode()->GetId() 
-                   << " received at time " << Simulator::Now().GetSeconds() 
-                   << "s: " << received);
+void DepartmentFlowMatrix::Export(MetricsTable& table) const {
+    for (uint32_t row = 0; row < m_size; ++row) {
+        for (uint32_t column = 0; column < m_size; ++column) {
+            const Cell& cell = m_cells[row * m_size + column];
+            if (cell.flows == 0) {
+                continue;
+            }
+            double packets = cell.rxPackets + cell.lostPackets;
+            table.AddRow({ row + 1 < m_size ? m_topology.departments[row].name : "Core switches",
+                           column + 1 < m_size ? m_topology.departments[column].name : "Core switches" }, {
+                cell.flows, cell.conversations, cell.oneWay, cell.txPackets, cell.rxPackets, cell.lostPackets,
+                cell.rxBytes, cell.throughput / 1000,
+                cell.rxPackets > 0 ? cell.delaySum / cell.rxPackets : 0.0,
+                packets > 0 ? cell.lostPackets / packets : 0.0,
+                cell.conversations > 0 ? cell.rttSum / cell.conversations : 0.0 });
+        }
     }
 }
 
-// Custom Server Application
-class CustomServer : public Application {
-private:
-    virtual void StartApplication(void);
-    virtual void StopApplication(void);
-
-    void HandleAccept(Ptr<Socket> socket, const Address& from);
-    void HandleRead(Ptr<Socket> socket);
 
-    Ptr<Socket> m_socket;
-    uint16_t m_port;
-    uint32_t m_messagesReceived;
+// Simulator self-benchmark
+//
+// RunScenario times its own phases with the wall clock and counts the events the
+// scheduler executed, so the cost of the simulator can be followed as the
+// topology grows. With --selfBenchmark each run appends one row to a CSV that is
+// never truncated; rows from different builds are told apart by their label.
+//   label,scheduler,nodes,links,clients,<phase seconds...>,total,events,eventsPerSecond,peakRssMB
 
-public:
-    CustomServer();
-    virtual ~CustomServer();
-    void Setup(uint16_t port);
+enum RunPhase {
+    PHASE_TOPOLOGY,             // description, partition, nodes, links, addresses, queue discs
+    PHASE_SETUP,                // statistics collectors and applications
+    PHASE_ROUTING,              // global routing tables, ECMP and failure scheduling
+    PHASE_RUN,                  // Simulator::Run, pcap writing included
+    PHASE_ARTIFACTS,            // time series, event trace and animation files
+    PHASE_STATISTICS,           // flow statistics and result tables
+    PHASE_OUTPUT,               // metrics files
+    PHASE_COUNT
 };
 
-CustomServer::CustomServer() : m_socket(0), m_port(0), m_messagesReceived(0)  {}
+static const char *kPhaseNames[PHASE_COUNT] = {
+    "topology", "setup", "routing", "run", "artifacts", "statistics", "output"
+};
 
-CustomServer::~CustomServer() {
-    m_socket = 0;
-}
+class PhaseTimer {
+public:
+    PhaseTimer() : m_current(PHASE_COUNT) { std::fill(m_seconds, m_seconds + PHASE_COUNT, 0.0); }
 
-void CustomServer::Setup(uint16_t port) {
-    m_port = port;
-}
+    // Ends the current phase and starts the next
+    void Enter(RunPhase phase) {
+        Stop();
+        m_current = phase;
+        m_since = std::chrono::steady_clock::now();
+    }
+    void Stop(void) {
+        if (m_current != PHASE_COUNT) {
+            m_seconds[m_current] += std::chrono::duration<double>(std::chrono::steady_clock::now() - m_since).count();
+            m_current = PHASE_COUNT;
+        }
+    }
+    double GetSeconds(RunPhase phase) const { return m_seconds[phase]; }
 
-void CustomServer::StartApplication(void) {
-    m_socket = Socket::CreateSocket(GetNode(), TcpSocketFactory::GetTypeId());
-    InetSocketAddress local = InetSocketAddress(Ipv4Address::GetAny(), m_port);
-    m_socket->Bind(local);
-    m_socket->Listen();
-    m_socket->SetAcceptCallback(
-        MakeNullCallback<bool, Ptr<Socket>, const Address &>(),
-        MakeCallback(&CustomServer::HandleAccept, this));
-    NS_LOG_INFO("Server started on node " << GetNode()->GetId());
-}
+private:
+    RunPhase m_current;
+    std::chrono::steady_clock::time_point m_since;
+    double m_seconds[PHASE_COUNT];
+};
 
-void CustomServer::StopApplication(void) {
-    if (m_socket) {
-        m_socket->Close();
+static const char *SchedulerTypeName(const std::string& name) {
+    if (name == "map") {
+        return "ns3::MapScheduler";
+    } else if (name == "heap") {
+        return "ns3::HeapScheduler";
+    } else if (name == "calendar") {
+        return "ns3::CalendarScheduler";
+    } else if (name == "list") {
+        return "ns3::ListScheduler";
+    } else if (name == "priority") {
+        return "ns3::PriorityQueueScheduler";
     }
+    NS_FATAL_ERROR("Unknown scheduler " << name);
+    return "";
 }
 
-void CustomServer::HandleAccept(Ptr<Socket> socket, const Address& from) {
-    socket->SetRecvCallback(MakeCallback(&CustomServer::HandleRead, this));
-    NS_LOG_INFO("Server accepted connection from " << InetSocketAddress::ConvertFrom(from).GetIpv4());
+// Peak resident set size of this process in MB
+static double PeakMemoryMegabytes(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0.0;
+    }
+    return usage.ru_maxrss / 1024.0;    // kilobytes on Linux
 }
 
-void CustomServer::HandleRead(Ptr<Socket> socket) {
-    Ptr<Packet> packet;
-    Address from;
-    while ((packet = socket->RecvFrom(from))) {
-        uint8_t buffer[1024];
-        packet->CopyData(buffer, packet->GetSize());
-        std::string received = std::string((char*)buffer, packet->GetSize());
-        m_messagesReceived++;
-        NS_LOG_INFO("Server received message " << m_messagesReceived 
-                   << " at time " << Simulator::Now().GetSeconds() 
-                   << "s: " << received);
-        
-        // Send response back to client
-        std::string response = "Hello from server! do you want anything else"+ std::to_string(m_messagesReceived);
-        Ptr<Packet> responsePacket = Create<Packet>((uint8_t*) response.c_str(), response.length());
-        socket->Send(responsePacket);
-        NS_LOG_INFO("Server sent response: " << response);
+static void AppendSelfBenchmark(const ScenarioConfig& config, const CampusTopology& topology, uint32_t clients,
+                                const PhaseTimer& timer, uint64_t events, double peakMemory) {
+    std::string filename = RankFileName(config.selfBenchmarkFile);
+    std::ofstream out(filename.c_str(), std::ios::app);
+    NS_ABORT_MSG_IF(!out, "Cannot open " << filename);
+    if (out.tellp() == 0) {
+        out << "label,scheduler,nodes,links,clients";
+        for (uint32_t p = 0; p < PHASE_COUNT; ++p) {
+            out << "," << kPhaseNames[p];
+        }
+        out << ",total,events,eventsPerSecond,peakRssMB\n";
     }
+    double total = 0.0;
+    out << config.selfBenchmarkLabel << "," << config.scheduler << "," << topology.GetNNodes() << ","
+        << topology.GetNLinks() << "," << clients;
+    for (uint32_t p = 0; p < PHASE_COUNT; ++p) {
+        out << "," << timer.GetSeconds((RunPhase)p);
+        total += timer.GetSeconds((RunPhase)p);
+    }
+    double run = timer.GetSeconds(PHASE_RUN);
+    out << "," << total << "," << events << "," << (run > 0 ? events / run : 0.0) << "," << peakMemory << "\n";
 }
 
 
-int main(int argc, char *argv[])
+NetworkMetrics RunScenario(const ScenarioConfig& config)
 {
-    LogComponentEnable ("BulkSendApplication", LOG_LEVEL_INFO);
-    LogComponentEnable ("PacketSink", LOG_LEVEL_INFO);
-    LogComponentEnable("top", LOG_LEVEL_INFO);
+    PhaseTimer timer;
+    timer.Enter(PHASE_TOPOLOGY);
+    RngSeedManager::SetSeed(config.seed);
+    ConfigureTransport(config);
+    ObjectFactory scheduler;
+    scheduler.SetTypeId(SchedulerTypeName(config.scheduler));
+    Simulator::SetScheduler(scheduler);
+
+    // Build nodes, links and addressing from the topology description
+    CampusTopology topology;
+    if (config.departmentCount > 0) {
+        topology.Generate(config.departmentCount, config.hostsPerDepartment, config.coreCount);
+    } else if (!config.topologyFile.empty()) {
+        topology.LoadFile(config.topologyFile);
+    } else {
+        topology.LoadDefault();
+    }
+    if (!config.dataRate.empty()) {
+        topology.SetLinkProfile(config.dataRate, config.delay);
+    }
 
-    // Create nodes
-    NodeContainer nodes;
-    nodes.Create(26); 
-    
     PointToPointHelper p2p;
-    p2p.SetDeviceAttribute("DataRate", StringValue("1Mbps"));
-    p2p.SetChannelAttribute("Delay", StringValue("2ms"));
-  
-    // Create separate links
-    NetDeviceContainer devices01, devices02, devices03; 
-    NetDeviceContainer devices45, devices46;           
-    NetDeviceContainer devices89, devices810;          
-    NetDeviceContainer devices1112, devices1113, devices1114; 
-    NetDeviceContainer devices1516;
-    NetDeviceContainer devices1718;
-    NetDeviceContainer devices1920;
-    NetDeviceContainer devices2122;
-    NetDeviceContainer devices2324;
-    NetDeviceContainer devices70, devices74, devices78, devices711;
-    NetDeviceContainer devices715, devices717, devices719, devices721, devices723;
-    NetDeviceContainer devices250, devices254, devices258, devices2511;
-    NetDeviceContainer devices2515, devices2517, devices2519, devices2521, devices2523;
-
-    // Department connections
-    devices01 = p2p.Install(nodes.Get(0), nodes.Get(1)); 
-    devices02 = p2p.Install(nodes.Get(0), nodes.Get(2));
-    devices03 = p2p.Install(nodes.Get(0), nodes.Get(3));
-    devices45 = p2p.Install(nodes.Get(4), nodes.Get(5));
-    devices46 = p2p.Install(nodes.Get(4), nodes.Get(6));
-    devices89 = p2p.Install(nodes.Get(8), nodes.Get(9));
-    devices810 = p2p.Install(nodes.Get(8), nodes.Get(10));
-    devices1112 = p2p.Install(nodes.Get(11), nodes.Get(12));
-    devices1113 = p2p.Install(nodes.Get(11), nodes.Get(13));
-    devices1114 = p2p.Install(nodes.Get(11), nodes.Get(14));
-    devices1516 = p2p.Install(nodes.Get(15), nodes.Get(16));
-    devices1718 = p2p.Install(nodes.Get(17), nodes.Get(18));
-    devices1920 = p2p.Install(nodes.Get(19), nodes.Get(20));
-    devices2122 = p2p.Install(nodes.Get(21), nodes.Get(22));
-    devices2324 = p2p.Install(nodes.Get(23), nodes.Get(24));
-    
-    // Multilayer switch connections node 7
-    devices70 = p2p.Install(nodes.Get(7), nodes.Get(0));
-    devices74 = p2p.Install(nodes.Get(7), nodes.Get(4));
-    devices78 = p2p.Install(nodes.Get(7), nodes.Get(8));
-    devices711 = p2p.Install(nodes.Get(7), nodes.Get(11));
-    devices715 = p2p.Install(nodes.Get(7), nodes.Get(15));
-    devices717 = p2p.Install(nodes.Get(7), nodes.Get(17));
-    devices719 = p2p.Install(nodes.Get(7), nodes.Get(19));
-    devices721 = p2p.Install(nodes.Get(7), nodes.Get(21));
-    devices723 = p2p.Install(nodes.Get(7), nodes.Get(23));
-    
-    // Multilayer switch connections node 25
-    devices250 = p2p.Install(nodes.Get(25), nodes.Get(0));
-    devices254 = p2p.Install(nodes.Get(25), nodes.Get(4));
-    devices258 = p2p.Install(nodes.Get(25), nodes.Get(8));
-    devices2511 = p2p.Install(nodes.Get(25), nodes.Get(11));
-    devices2515 = p2p.Install(nodes.Get(25), nodes.Get(15));
-    devices2517 = p2p.Install(nodes.Get(25), nodes.Get(17));
-    devices2519 = p2p.Install(nodes.Get(25), nodes.Get(19));
-    devices2521 = p2p.Install(nodes.Get(25), nodes.Get(21));
-    devices2523 = p2p.Install(nodes.Get(25), nodes.Get(23));
-
-    // Install Internet stack
-    InternetStackHelper internet;
-    internet.Install(nodes);
+    topology.Partition(RankCount());
+    topology.Build(p2p);
+    InstallBackboneQueueDiscs(topology, config.queueDisc);
+    NodeContainer& nodes = topology.nodes;
+    uint32_t serverNode = config.serverNode;
+    NS_ABORT_MSG_IF(serverNode >= nodes.GetN() || config.clientNode >= nodes.GetN(), "Server or client node outside the topology");
+    Ipv4Address serverAddress = topology.GetNodeAddress(serverNode);
+    bool distributed = RankCount() > 1;
+    uint32_t reportingRank = topology.nodeInfo[serverNode].systemId;
+    bool reporting = LocalRank() == reportingRank;
 
-    // Flow Monitor installation
-    FlowMonitorHelper flowMonitor;
-    Ptr<FlowMonitor> monitor = flowMonitor.InstallAll();
-  
-    // IP address assignment
-    Ipv4AddressHelper chaine_info_address;
-    chaine_info_address.SetBase("192.168.10.0", "255.255.255.0");
-    Ipv4InterfaceContainer interfaces01 = chaine_info_address.Assign(devices01);
-    Ipv4InterfaceContainer interfaces02 = chaine_info_address.Assign(devices02);
-    Ipv4InterfaceContainer interfaces03 = chaine_info_address.Assign(devices03);
-  
-    Ipv4AddressHelper noyau_address;
-    noyau_address.SetBase("192.168.20.0", "255.255.255.0");
-    Ipv4InterfaceContainer interfaces45 = noyau_address.Assign(devices45);
-    Ipv4InterfaceContainer interfaces46 = noyau_address.Assign(devices46);
-     
-    Ipv4AddressHelper fibreHome_address;
-    fibreHome_address.SetBase("192.168.30.0", "255.255.255.0");
-    Ipv4InterfaceContainer interfaces89 = fibreHome_address.Assign(devices89);
-    Ipv4InterfaceContainer interfaces810 = fibreHome_address.Assign(devices810);
-    
-    Ipv4AddressHelper commutation_address;
-    commutation_address.SetBase("192.168.40.0", "255.255.255.0");
-    Ipv4InterfaceContainer interfaces1112 = commutation_address.Assign(devices1112);
-    Ipv4InterfaceContainer interfaces1113 = commutation_address.Assign(devices1113);
-    Ipv4InterfaceContainer interfaces1114 = commutation_address.Assign(devices1114);
-
-    Ipv4AddressHelper ericson_address;
-    ericson_address.SetBase("192.168.50.0", "255.255.255.0");
-    Ipv4InterfaceContainer interfaces1516 = ericson_address.Assign(devices1516);
-    
-    Ipv4AddressHelper chaine_mecanique_address;
-    chaine_mecanique_address.SetBase("192.168.60.0", "255.255.255.0");
-    Ipv4InterfaceContainer interfaces1718 = chaine_mecanique_address.Assign(devices1718);
-    
-    Ipv4AddressHelper finance_address;
-    finance_address.SetBase("192.168.70.0", "255.255.255.0");
-    Ipv4InterfaceContainer interfaces1920 = finance_address.Assign(devices1920);
-
-    Ipv4AddressHelper infermerie_address;
-    infermerie_address.SetBase("192.168.80.0", "255.255.255.0");
-    Ipv4InterfaceContainer interfaces2122 = infermerie_address.Assign(devices2122);
-
-    Ipv4AddressHelper pc_address;
-    pc_address.SetBase("192.168.90.0", "255.255.255.0");
-    Ipv4InterfaceContainer interfaces2324 = pc_address.Assign(devices2324);
-
-    Ipv4AddressHelper backbone1_address;
-    backbone1_address.SetBase("192.168.100.0", "255.255.255.0");
-    Ipv4InterfaceContainer interfaces70 = backbone1_address.Assign(devices70);
-    Ipv4InterfaceContainer interfaces74 = backbone1_address.Assign(devices74);
-    Ipv4InterfaceContainer interfaces78 = backbone1_address.Assign(devices78);
-    Ipv4InterfaceContainer interfaces711 = backbone1_address.Assign(devices711);
-    Ipv4InterfaceContainer interfaces715 = backbone1_address.Assign(devices715);
-    Ipv4InterfaceContainer interfaces717 = backbone1_address.Assign(devices717);
-    Ipv4InterfaceContainer interfaces719 = backbone1_address.Assign(devices719);
-    Ipv4InterfaceContainer interfaces721 = backbone1_address.Assign(devices721);
-    Ipv4InterfaceContainer interfaces723 = backbone1_address.Assign(devices723);
-  
-    Ipv4AddressHelper backbone2_address;
-    backbone2_address.SetBase("192.168.110.0", "255.255.255.0");
-    Ipv4InterfaceContainer interfaces250 = backbone2_address.Assign(devices250);
-    Ipv4InterfaceContainer interfaces254 = backbone2_address.Assign(devices254);
-    Ipv4InterfaceContainer interfaces258 = backbone2_address.Assign(devices258);
-    Ipv4InterfaceContainer interfaces2511 = backbone2_address.Assign(devices2511);
-    Ipv4InterfaceContainer interfaces2515 = backbone2_address.Assign(devices2515);
-    Ipv4InterfaceContainer interfaces2517 = backbone2_address.Assign(devices2517);
-    Ipv4InterfaceContainer interfaces2519 = backbone2_address.Assign(devices2519);
-    Ipv4InterfaceContainer interfaces2521 = backbone2_address.Assign(devices2521);
-    Ipv4InterfaceContainer interfaces2523 = backbone2_address.Assign(devices2523);  
-    
+    // Flow counters come from the packet tags, the same way sequential and distributed
+    timer.Enter(PHASE_SETUP);
+    if (distributed && reporting) {
+        NS_LOG_INFO("Distributed run over " << RankCount() << " ranks, reporting from rank " << reportingRank);
+    }
+    PacketStatsCollector packetStats(topology);
+    packetStats.Install();
+    LinkLoadMonitor linkLoad(topology);
+    linkLoad.Start();
+    // Batches start with the clients
+    NS_ABORT_MSG_IF(distributed && config.precision > 0, "Early termination needs every rank's deliveries and cannot run distributed");
+    ConvergenceMonitor convergence(serverAddress, linkLoad, Seconds(config.batchInterval), config.precision,
+                                   config.lossTolerance, config.minBatches);
+    if (config.precision > 0) {
+        convergence.Start(packetStats, Seconds(2.0));
+    }
 
     // TCP Server setup
     uint16_t port = 8080;
     Ptr<CustomServer> server = CreateObject<CustomServer>();
     server->Setup(port);
-    nodes.Get(6)->AddApplication(server);
+    server->SetService(config.service);
+    int64_t stream = 1000;
+    stream += server->AssignStreams(stream);
+    EventTrace *trace = 0;
+    if (config.writeArtifacts && !config.traceFile.empty()) {
+        trace = new EventTrace(config.traceCapacity);
+        server->SetTrace(trace);
+    }
+    // Applications are created on every rank, in the same order, but run only where their node lives
+    if (topology.nodeInfo[serverNode].systemId == LocalRank()) {
+        nodes.Get(serverNode)->AddApplication(server);
+    }
     server->SetStartTime(Seconds(1.0));
-    server->SetStopTime(Seconds(10.0));
-
-    // First TCP Client
-    Ptr<CustomClient> client1 = CreateObject<CustomClient>();
-    client1->Setup(InetSocketAddress(interfaces46.GetAddress(1), port), 1024);
-    nodes.Get(22)->AddApplication(client1);
-    client1->SetStartTime(Seconds(2.0));
-    client1->SetStopTime(Seconds(10.0));
-
-    // Second TCP Client
-    //Ptr<CustomClient> client2 = CreateObject<CustomClient>();
-    //client2->Setup(InetSocketAddress(interfaces46.GetAddress(1), port), 1024);
-    //nodes.Get(24)->AddApplication(client2);
-    //client2->SetStartTime(Seconds(3.0));
-    //client2->SetStopTime(Seconds(20.0));
+    server->SetStopTime(Seconds(config.stopTime));
 
-    
+    // Edge caches on every department switch; the clients of a department request through its cache
+    NS_ABORT_MSG_IF(distributed && config.cache.policy != CACHE_OFF, "Edge caches cannot run distributed");
+    uint16_t cachePort = 8081;
+    std::vector<Ptr<EdgeCache> > caches;
+    if (config.cache.policy != CACHE_OFF) {
+        for (uint32_t d = 0; d < topology.departments.size(); ++d) {
+            Ptr<EdgeCache> cache = CreateObject<EdgeCache>();
+            caches.push_back(cache);
+            cache->Setup(cachePort, InetSocketAddress(serverAddress, port), config.cache);
+            nodes.Get(topology.departments[d].switchNode)->AddApplication(cache);
+            cache->SetStartTime(Seconds(1.0));
+            cache->SetStopTime(Seconds(config.stopTime));
+        }
+    }
+
+    // TCP Clients: the configured client node first, then the other hosts in order (all of them for 0)
+    std::vector<uint32_t> clientNodes(1, config.clientNode);
+    for (uint32_t id = 0; id < nodes.GetN() && (config.clientCount == 0 || clientNodes.size() < config.clientCount); ++id) {
+        if (topology.nodeInfo[id].role == ROLE_HOST && id != serverNode && id != config.clientNode) {
+            clientNodes.push_back(id);
+        }
+    }
+    std::vector<Ptr<CustomClient> > clients;
+    for (size_t i = 0; i < clientNodes.size(); ++i) {
+        Ptr<CustomClient> client = CreateObject<CustomClient>();
+        clients.push_back(client);
+        if (caches.empty()) {
+            client->Setup(InetSocketAddress(serverAddress, port), 1024, config.messageInterval);
+        } else {
+            uint32_t switchNode = topology.departments[topology.nodeInfo[clientNodes[i]].department].switchNode;
+            client->Setup(InetSocketAddress(topology.GetNodeAddress(switchNode), cachePort), 1024, config.messageInterval);
+        }
+        client->SetLoad(config.load);
+        client->SetTrace(trace);
+        stream += client->AssignStreams(stream);
+        if (topology.nodeInfo[clientNodes[i]].systemId == LocalRank()) {
+            nodes.Get(clientNodes[i])->AddApplication(client);
+        }
+        client->SetStartTime(Seconds(2.0));
+        client->SetStopTime(Seconds(config.stopTime));
+    }
+
+    // Traffic-matrix flows between the leaf hosts, alongside the clients
+    NS_ABORT_MSG_IF(distributed && !config.trafficMatrix.empty(), "The traffic-matrix workload cannot run distributed");
+    std::vector<TrafficDemand> demands;
+    if (!config.trafficMatrix.empty()) {
+        demands = LoadTrafficMatrix(config.trafficMatrix, topology);
+    }
+    WorkloadEngine workload(topology, demands);
+    stream += workload.AssignStreams(stream);
+    if (!demands.empty()) {
+        workload.Start(Seconds(2.0), Seconds(config.stopTime));
+    }
+
+    timer.Enter(PHASE_ROUTING);
     Ipv4GlobalRoutingHelper::PopulateRoutingTables();
+    // Failures are routed around by route repair, which works through the ECMP layer
+    RouteRepair repair(topology);
+    FailureInjector failures(topology, repair, Seconds(config.convergenceDelay));
+    if (config.ecmp != ECMP_OFF || !config.failures.empty()) {
+        EcmpRouting::Install(nodes, config.ecmp, Seconds(config.flowletGap), config.failures.empty() ? 0 : &repair);
+    }
+    if (!config.failures.empty()) {
+        failures.Schedule(config.failures, packetStats);
+    }
     
-    // Pcap captures
-    p2p.EnablePcap("server", devices46.Get(1));
-    p2p.EnablePcap("client1", devices2122.Get(1));
-    //p2p.EnablePcap("client2", devices2324.Get(1));
-  
-    AnimationInterface anim("animation1.xml");
-    
-    // Node positions
-    anim.SetConstantPosition(nodes.Get(7), 50.0, 20.0);
-    anim.SetConstantPosition(nodes.Get(25), 118.0, 20.0);
-    
-    // Department switch positions
-    anim.SetConstantPosition(nodes.Get(0), 5.0, 60.0);
-    anim.SetConstantPosition(nodes.Get(4), 30.0, 60.0);
-    anim.SetConstantPosition(nodes.Get(8), 50.0, 60.0);
-    anim.SetConstantPosition(nodes.Get(11), 70.0, 60.0);
-    anim.SetConstantPosition(nodes.Get(15), 90.0, 60.0);
-    anim.SetConstantPosition(nodes.Get(17), 110.0, 60.0);
-    anim.SetConstantPosition(nodes.Get(19), 130.0, 60.0);
-    anim.SetConstantPosition(nodes.Get(21), 150.0, 60.0);
-    anim.SetConstantPosition(nodes.Get(23), 170.0, 60.0);
-    
-    // End node positions
-    anim.SetConstantPosition(nodes.Get(1), 0.0, 90.0);
-    anim.SetConstantPosition(nodes.Get(2), 10.0, 90.0);
-    anim.SetConstantPosition(nodes.Get(3), 20.0, 90.0);
-    anim.SetConstantPosition(nodes.Get(5), 25.0, 90.0);
-    anim.SetConstantPosition(nodes.Get(6), 35.0, 90.0);
-    anim.SetConstantPosition(nodes.Get(9), 45.0, 90.0);
-    anim.SetConstantPosition(nodes.Get(10), 55.0, 90.0);
-    anim.SetConstantPosition(nodes.Get(12), 65.0, 90.0);
-    anim.SetConstantPosition(nodes.Get(13), 75.0, 90.0);
-    anim.SetConstantPosition(nodes.Get(14), 85.0, 90.0);
-    anim.SetConstantPosition(nodes.Get(16), 90.0, 90.0);
-    anim.SetConstantPosition(nodes.Get(18), 110.0, 90.0);
-    anim.SetConstantPosition(nodes.Get(20), 130.0, 90.0);
-    anim.SetConstantPosition(nodes.Get(22), 150.0, 90.0);
-    anim.SetConstantPosition(nodes.Get(24), 170.0, 90.0);
-
-    // Node descriptions
-    anim.UpdateNodeDescription(nodes.Get(7), "Multilayer1 ");
-    anim.UpdateNodeDescription(nodes.Get(25), "Multilayer2 ");
-    anim.UpdateNodeDescription(nodes.Get(0), "Chaine Info ");
-    anim.UpdateNodeDescription(nodes.Get(4), "Noyau ");
-    anim.UpdateNodeDescription(nodes.Get(8), "FibreHome ");
-    anim.UpdateNodeDescription(nodes.Get(11), "Commutation ");
-    anim.UpdateNodeDescription(nodes.Get(15), "Ericson ");
-    anim.UpdateNodeDescription(nodes.Get(17), "Chaine mécanique ");
-    anim.UpdateNodeDescription(nodes.Get(19), "Finance ");
-    anim.UpdateNodeDescription(nodes.Get(21), "Infermerie ");
-    anim.UpdateNodeDescription(nodes.Get(23), "PC ");
-    
-    anim.EnablePacketMetadata(true);
+    // Pcap captures and animation are per-run artifacts, skipped in sweeps
+    AnimationInterface *anim = 0;
+    if (config.writeArtifacts && reporting) {
+        p2p.EnablePcap("server", topology.GetNodeDevice(serverNode));
+    }
+    if (config.writeArtifacts && topology.nodeInfo[config.clientNode].systemId == LocalRank()) {
+        p2p.EnablePcap("client1", topology.GetNodeDevice(config.clientNode));
+    }
+    if (config.writeArtifacts && !config.animation.file.empty()) {
+        // Bounded to the configured window, without per-packet metadata; positions come from the node table
+        anim = new AnimationInterface(RankFileName(config.animation.file));
+        topology.ApplyAnimationLayout(*anim);
+        anim->EnablePacketMetadata(false);
+        anim->SetStartTime(Seconds(config.animation.start));
+        if (config.animation.stop > 0) {
+            anim->SetStopTime(Seconds(config.animation.stop));
+        }
+        anim->SetMaxPktsPerTraceFile(config.animation.maxPackets);
+    }
+
+    // Periodic per-flow/per-link sampling during the run
+    TimeSeriesSampler *sampler = 0;
+    if (config.writeArtifacts && config.sampleInterval > 0) {
+        sampler = new TimeSeriesSampler(topology, packetStats, Seconds(config.sampleInterval), RankFileName(config.timeSeriesFile));
+        sampler->Start();
+    }
 
     // Run simulation
-    Simulator::Stop(Seconds(10.0));
+    Simulator::Stop(Seconds(config.stopTime));
+    timer.Enter(PHASE_RUN);
     Simulator::Run();
+    timer.Enter(PHASE_ARTIFACTS);
+    uint64_t events = Simulator::GetEventCount();
+
+    if (sampler) {
+        sampler->Finish();
+        delete sampler;
+    }
+    if (trace) {
+        trace->Write(RankFileName(config.traceFile));
+        delete trace;
+    }
 
 
-    // Collect Enhanced Flow Statistics
-    monitor->CheckForLostPackets();
-    Ptr<Ipv4FlowClassifier> classifier = DynamicCast<Ipv4FlowClassifier>(flowMonitor.GetClassifier());
-    std::map<FlowId, FlowMonitor::FlowStats> stats = monitor->GetFlowStats();
+    // Collect Enhanced Flow Statistics; the reporting rank holds every flow's counters after the merge
+    timer.Enter(PHASE_STATISTICS);
+    packetStats.MergeAcrossRanks(reportingRank);
 
 
-    NetworkMetrics metrics;
-    metrics.packetDelays.clear();
+    NetworkMetrics metrics = NetworkMetrics();
     double totalThroughput = 0.0;
     double totalLatency = 0.0;
+    double totalJitter = 0.0;
+    StreamingDelayStats serverFlowStats;
     uint32_t flowCount = 0;
-    uint64_t totalBytes = 0;
     double simulationTime = Simulator::Now().GetSeconds();
 
-     // Open a file for detailed flow statistics
-    std::ofstream detailedStats;
-    detailedStats.open("detailed_enhanced_statistics.txt");
-    detailedStats << "Detailed Enhanced Network Statistics\n";
-    detailedStats << "===================================\n\n";
+    // Result tables; times in seconds, throughput in kilobytes per second
+    MetricsTable flowTable("flows", { "source", "destination" }, {
+        "flowId", "throughputKBps", "latency", "rtt", "jitter", "latencyP50", "latencyP99", "latencyP999",
+        "lostPackets", "rxPackets", "timesForwarded" });
+    std::ostringstream address;
 
-    for (std::map<FlowId, FlowMonitor::FlowStats>::const_iterator i = stats.begin(); i != stats.end(); ++i) {
-        Ipv4FlowClassifier::FiveTuple t = classifier->FindFlow(i->first);
+    // Every flow goes into the department matrix; flows to the server also make the
+    // per-flow table and the headline metrics
+    DepartmentFlowMatrix flowMatrix(topology);
+    std::vector<uint32_t> flowOrder = packetStats.GetFlowsInKeyOrder();
+    for (uint32_t position = 0; reporting && position < flowOrder.size(); ++position) {
+        uint32_t f = flowOrder[position];
+        const FlowKey& key = packetStats.GetFlowKey(f);
+        const FlowTotals& totals = packetStats.GetFlowTotals(f);
+        double duration = totals.txPackets > 0 && totals.rxPackets > 0 ? totals.lastRx - totals.firstTx : 0.0;
+        FlowSample sample = { totals.txPackets, totals.rxPackets, totals.lostPackets, totals.rxBytes,
+                              totals.delaySum, duration };
+        flowMatrix.Add(key, sample);
         
         // Only consider flows from clients to server
-        if (t.destinationAddress == interfaces46.GetAddress(1)) {
+        if (Ipv4Address(key.destination) == serverAddress) {
             flowCount++;
             
-            // Calculate basic metrics
-            double throughput = (i->second.rxBytes +i->second.txBytes)/ 
-                             (i->second.timeLastRxPacket.GetSeconds() - 
-                              i->second.timeFirstTxPacket.GetSeconds()) / 1000;
+            // Calculate basic metrics; a flow that delivered nothing has no rate or delay
+            double throughput = duration > 0 ? (totals.rxBytes + totals.txBytes) / duration / 1000 : 0.0;
             
-            double latency = i->second.delaySum.GetSeconds() / i->second.rxPackets;
+            double latency = totals.rxPackets > 0 ? totals.delaySum / totals.rxPackets : 0.0;
             
-            // Collect packet delays for jitter calculation
-            if (i->second.rxPackets > 0) {
-                metrics.packetDelays.push_back(i->second.delaySum.GetSeconds() / i->second.rxPackets);
-            }
+            // Per-packet delay distribution of this flow, recorded where the server delivers
+            const StreamingDelayStats& flowStats = packetStats.GetFlowStats(f);
+            totalJitter += flowStats.GetJitter();
+            serverFlowStats.Merge(flowStats);
             
             // Accumulate totals
             totalThroughput += throughput;
             totalLatency += latency;
-            totalBytes += i->second.rxBytes;
             
             // RTT calculation
-            double rtt = i->second.delaySum.GetSeconds() / i->second.rxPackets * 2;
+            double rtt = latency * 2;
             
-            // Write detailed statistics for each flow
-            detailedStats << "Flow " << i->first << "\n";
-            detailedStats << "Source: " << t.sourceAddress << "\n";
-            detailedStats << "Destination: " << t.destinationAddress << "\n";
-            detailedStats << "Throughput: " << throughput << " KBytes\n";
-            detailedStats << "Latency: " << latency * 1000 << " ms\n";
-            detailedStats << "RTT: " << rtt * 1000 << " ms\n";
-            detailedStats << "Lost Packets: " << i->second.lostPackets << "\n";
-            detailedStats << "Received Packets: " << i->second.rxPackets << "\n";
-            detailedStats << "Control Packets: " << i->second.timesForwarded << "\n";
-            detailedStats << "---------------------------\n\n";
+            // One row per flow
+            std::string source, destination;
+            address.str("");
+            address << Ipv4Address(key.source);
+            source = address.str();
+            address.str("");
+            address << Ipv4Address(key.destination);
+            destination = address.str();
+            flowTable.AddRow({ source, destination }, {
+                (double)position, throughput, latency, rtt, flowStats.GetJitter(),
+                flowStats.GetQuantile(0.5), flowStats.GetQuantile(0.99), flowStats.GetQuantile(0.999),
+                (double)totals.lostPackets, (double)totals.rxPackets, (double)totals.timesForwarded });
 
             // Update metrics structure
-            metrics.totalLostPackets += i->second.lostPackets;
-            metrics.totalRxPackets += i->second.rxPackets;
-            metrics.controlPackets += i->second.timesForwarded;
+            metrics.totalLostPackets += totals.lostPackets;
+            metrics.totalRxPackets += totals.rxPackets;
+            metrics.controlPackets += totals.timesForwarded;
         }
     }
+    flowMatrix.Finish();
+    MetricsTable matrixTable("matrix", { "source", "destination" }, {
+        "flows", "conversations", "oneWay", "txPackets", "rxPackets", "lostPackets", "rxBytes",
+        "throughputKBps", "meanDelay", "lossRatio", "meanRtt" });
+    flowMatrix.Export(matrixTable);
     
-    detailedStats.close();
+    // Per-department delay of every delivered packet, by source department
+    std::vector<StreamingDelayStats> departmentStats = packetStats.GetDepartmentStats();
+    MergeAcrossRanks(departmentStats, reportingRank);
+    MetricsTable departmentTable("departments", { "department" }, {
+        "packets", "meanDelay", "delayStdDev", "delayP50", "delayP99", "delayP999" });
+    for (size_t d = 0; d < departmentStats.size(); ++d) {
+        const StreamingDelayStats& department = departmentStats[d];
+        if (department.GetCount() == 0) {
+            continue;
+        }
+        departmentTable.AddRow({ d < topology.departments.size() ? topology.departments[d].name : "Core switches" }, {
+            (double)department.GetCount(), department.GetMean(), std::sqrt(department.GetVariance()),
+            department.GetQuantile(0.5), department.GetQuantile(0.99), department.GetQuantile(0.999) });
+    }
+
+    MetricsTable connectionTable("connections", { "peer", "state" }, {
+        "connection", "requests", "served", "rejected", "outstanding", "bytesReceived", "bytesSent",
+        "meanQueueDelay", "meanServiceTime" });
+    MetricsTable clientTable("clients", { "client" }, { "bytes", "throughputBps" });
+    server->ExportConnections(connectionTable, clientTable);
+
+    // Department uplinks to the cores, both directions; share is of the department's upstream bytes
+    linkLoad.MergeAcrossRanks(reportingRank);
+    MetricsTable uplinkTable("uplinks", { "department", "core", "direction" }, {
+        "packets", "bytes", "utilization", "share" });
+    std::vector<uint64_t> departmentUpstream(topology.departments.size(), 0);
+    std::vector<uint32_t> uplinkDevices;
+    for (uint32_t i = 0; i < topology.links.size(); ++i) {
+        const TopologyLink& link = topology.links[i];
+        NodeRole roleA = topology.nodeInfo[link.nodeA].role;
+        NodeRole roleB = topology.nodeInfo[link.nodeB].role;
+        if (roleA == ROLE_DEPARTMENT && roleB == ROLE_CORE) {
+            uplinkDevices.push_back(2 * i);
+        } else if (roleA == ROLE_CORE && roleB == ROLE_DEPARTMENT) {
+            uplinkDevices.push_back(2 * i + 1);
+        }
+    }
+    std::vector<uint64_t> departmentDownstream(topology.departments.size(), 0);
+    for (size_t u = 0; u < uplinkDevices.size(); ++u) {
+        const TopologyLink& link = topology.links[uplinkDevices[u] / 2];
+        uint32_t department = topology.nodeInfo[uplinkDevices[u] % 2 == 0 ? link.nodeA : link.nodeB].department;
+        departmentUpstream[department] += linkLoad.GetBytes(uplinkDevices[u]);
+        departmentDownstream[department] += linkLoad.GetBytes(uplinkDevices[u] ^ 1);
+    }
+    uint64_t maxUpstream = 0, sumUpstream = 0;
+    for (size_t u = 0; u < uplinkDevices.size(); ++u) {
+        uint32_t up = uplinkDevices[u];
+        uint32_t down = up ^ 1;
+        const TopologyLink& link = topology.links[up / 2];
+        const TopologyNode& core = topology.nodeInfo[up % 2 == 0 ? link.nodeB : link.nodeA];
+        uint32_t department = topology.nodeInfo[up % 2 == 0 ? link.nodeA : link.nodeB].department;
+        const std::string& name = topology.departments[department].name;
+        uplinkTable.AddRow({ name, core.description, "up" }, {
+            (double)linkLoad.GetPackets(up), (double)linkLoad.GetBytes(up), linkLoad.GetUtilization(up),
+            departmentUpstream[department] > 0 ? (double)linkLoad.GetBytes(up) / departmentUpstream[department] : 0.0 });
+        uplinkTable.AddRow({ name, core.description, "down" }, {
+            (double)linkLoad.GetPackets(down), (double)linkLoad.GetBytes(down), linkLoad.GetUtilization(down),
+            departmentDownstream[department] > 0 ? (double)linkLoad.GetBytes(down) / departmentDownstream[department] : 0.0 });
+        maxUpstream = std::max(maxUpstream, linkLoad.GetBytes(up));
+        sumUpstream += linkLoad.GetBytes(up);
+    }
+    metrics.uplinkMaxToMean = sumUpstream > 0 ? (double)maxUpstream * uplinkDevices.size() / sumUpstream : 0.0;
+
+    // Most utilized link directions, each against its own DataRate; queue lengths in packets
+    std::vector<uint32_t> linkDevices(topology.linkDevices.size());
+    for (uint32_t d = 0; d < linkDevices.size(); ++d) {
+        linkDevices[d] = d;
+        metrics.linkQueueDrops += linkLoad.GetDrops(d);
+        metrics.maxLinkQueue = std::max(metrics.maxLinkQueue, linkLoad.GetPeakQueue(d));
+    }
+    std::stable_sort(linkDevices.begin(), linkDevices.end(), [&linkLoad](uint32_t a, uint32_t b) {
+        return linkLoad.GetUtilization(a) > linkLoad.GetUtilization(b);
+    });
+    if (config.topLinks > 0 && linkDevices.size() > config.topLinks) {
+        linkDevices.resize(config.topLinks);
+    }
+    MetricsTable linkTable("links", { "from", "to" }, {
+        "device", "bitRate", "packets", "bytes", "utilization", "meanQueue", "peakQueue", "drops" });
+    for (size_t l = 0; l < linkDevices.size(); ++l) {
+        uint32_t d = linkDevices[l];
+        const TopologyLink& link = topology.links[d / 2];
+        linkTable.AddRow({ topology.nodeInfo[d % 2 == 0 ? link.nodeA : link.nodeB].description,
+                           topology.nodeInfo[d % 2 == 0 ? link.nodeB : link.nodeA].description }, {
+            (double)d, (double)linkLoad.GetBitRate(d), (double)linkLoad.GetPackets(d), (double)linkLoad.GetBytes(d),
+            linkLoad.GetUtilization(d), linkLoad.GetMeanQueue(d), (double)linkLoad.GetPeakQueue(d),
+            (double)linkLoad.GetDrops(d) });
+    }
+    metrics.bandwidthUtilization = linkDevices.empty() ? 0.0 : linkLoad.GetUtilization(linkDevices[0]) * 100;
+    double backboneDelaySum = 0.0;
+    uint64_t backbonePackets = 0;
+    for (uint32_t d = 0; d < topology.linkDevices.size(); ++d) {
+        const TopologyLink& link = topology.links[d / 2];
+        if (topology.nodeInfo[link.nodeA].role != ROLE_HOST && topology.nodeInfo[link.nodeB].role != ROLE_HOST) {
+            backboneDelaySum += linkLoad.GetQueueDelay(d) * linkLoad.GetPackets(d);
+            backbonePackets += linkLoad.GetPackets(d);
+        }
+    }
+    metrics.backboneQueueDelay = backbonePackets > 0 ? backboneDelaySum / backbonePackets : 0.0;
+
+    // Throughput in bytes per second over windows as long as the outage
+    MetricsTable failureTable("failures", { "failure", "source", "destination" }, {
+        "lostPackets", "retransmissions", "throughputBefore", "throughputDuring", "throughputAfter",
+        "throughputDip", "stall", "recoveryTime" });
+    failures.Export(failureTable, metrics);
 
 
   // Calculate final metrics
-    metrics.avgThroughput = totalThroughput / flowCount;
-    metrics.avgLatency = totalLatency / flowCount;
-    metrics.jitter = CalculateJitter(metrics.packetDelays);
-    metrics.bandwidthUtilization = CalculateBandwidthUtilization(totalBytes, 100, simulationTime); // 100 Mbps link
-    metrics.rtt = totalLatency * 2 / flowCount; // Approximate RTT
-    metrics.networkOverhead = (double)metrics.controlPackets / (metrics.totalRxPackets +   metrics.controlPackets) * 100;
-    metrics.contentRetrievalTime = totalLatency / flowCount; // Average time to retrieve content
+    // No flow reached the server when it never answered or the run ended first
+    metrics.avgThroughput = flowCount > 0 ? totalThroughput / flowCount : 0.0;
+    metrics.avgLatency = flowCount > 0 ? totalLatency / flowCount : 0.0;
+    metrics.jitter = flowCount > 0 ? totalJitter / flowCount : 0.0;
+    metrics.latencyP50 = serverFlowStats.GetQuantile(0.5);
+    metrics.latencyP99 = serverFlowStats.GetQuantile(0.99);
+    metrics.latencyP999 = serverFlowStats.GetQuantile(0.999);
+    metrics.serverQueueDelay = server->GetMeanQueueDelay();
+    metrics.acceptDrops = server->GetAcceptDrops();
+    metrics.rejectedRequests = server->GetRejectedRequests();
+    metrics.serverMaxQueueLength = server->GetMaxQueueLength();
+    // Request/response timing measured by the clients themselves, merged in client order on every rank count
+    std::vector<StreamingDelayStats> clientStats(4 * clients.size());
+    for (size_t i = 0; i < clients.size(); ++i) {
+        clientStats[4 * i] = clients[i]->GetRequestLatency();
+        clientStats[4 * i + 1] = clients[i]->GetClientQueueDelay();
+        clientStats[4 * i + 2] = clients[i]->GetNetworkDelay();
+        clientStats[4 * i + 3] = clients[i]->GetServerDelay();
+    }
+    MergeAcrossRanks(clientStats, reportingRank);
+    StreamingDelayStats requestLatency, clientQueueDelay, networkDelay, serverDelay;
+    for (size_t i = 0; i < clients.size(); ++i) {
+        requestLatency.Merge(clientStats[4 * i]);
+        clientQueueDelay.Merge(clientStats[4 * i + 1]);
+        networkDelay.Merge(clientStats[4 * i + 2]);
+        serverDelay.Merge(clientStats[4 * i + 3]);
+    }
+    metrics.rtt = networkDelay.GetMean(); // Request sent to response received, minus server time
+    uint32_t carried = metrics.totalRxPackets + metrics.controlPackets;
+    metrics.networkOverhead = carried > 0 ? (double)metrics.controlPackets / carried * 100 : 0.0;
+    metrics.contentRetrievalTime = requestLatency.GetMean(); // Request generated to response received
+    metrics.requestLatencyP50 = requestLatency.GetQuantile(0.5);
+    metrics.requestLatencyP99 = requestLatency.GetQuantile(0.99);
+    metrics.requestLatencyP999 = requestLatency.GetQuantile(0.999);
+    metrics.clientQueueDelay = clientQueueDelay.GetMean();
+    metrics.serverTime = serverDelay.GetMean();
+    // Retrieval time by the clients' department, what a sweep compares against its cache=off runs
+    std::vector<StreamingDelayStats> departmentRetrieval(topology.departments.size());
+    for (size_t i = 0; i < clients.size(); ++i) {
+        departmentRetrieval[topology.nodeInfo[clientNodes[i]].department].Merge(clientStats[4 * i]);
+    }
+    for (size_t d = 0; d < departmentRetrieval.size(); ++d) {
+        metrics.departmentRetrieval.push_back(departmentRetrieval[d].GetMean());
+    }
+
+    // Edge caches by department, next to the request latency their clients measured
+    MetricsTable cacheTable("caches", { "department", "policy" }, {
+        "capacity", "requests", "hits", "misses", "coalesced", "relayed", "rejected", "hitRatio", "evictions",
+        "originBytes", "bytesSaved", "meanMissTime", "meanServedTime", "clientRetrievalTime" });
+    if (!caches.empty()) {
+        uint64_t named = 0, hits = 0;
+        for (size_t d = 0; d < caches.size(); ++d) {
+            caches[d]->Export(cacheTable, topology.departments[d].name, departmentRetrieval[d]);
+            named += caches[d]->GetNamedRequests();
+            hits += caches[d]->GetHits();
+            metrics.cacheBytesSaved += caches[d]->GetBytesSaved();
+        }
+        metrics.cacheHitRatio = named > 0 ? (double)hits / named : 0.0;
+    }
+
+    // Workload results by class; completion times in seconds, by object size for TCP classes
+    MetricsTable workloadTable("workload", { "class" }, {
+        "flows", "completed", "bytes", "fctMean", "fctP50", "fctP99",
+        "packetsSent", "packetsReceived", "deadlineMissRatio", "packetDelayMean", "packetDelayP99" });
+    MetricsTable fctTable("fct", { "class", "size" }, { "flows", "completed", "fctMean", "fctP50", "fctP99" });
+    workload.Export(workloadTable, fctTable, metrics);
 
-    // Write enhanced statistics
-    WriteEnhancedStatsToFile("enhanced_network_statistics.txt", metrics, simulationTime);
+    metrics.steadyStateWarmup = convergence.GetWarmup();
+    metrics.steadyStatePrecision = convergence.GetPrecision();
+    MetricsTable convergenceTable("convergence", { "metric" }, {
+        "mean", "halfWidth", "relativeHalfWidth", "batches", "batchesRun", "warmup" });
+    convergence.Export(convergenceTable);
+
+    metrics.runWallTime = timer.GetSeconds(PHASE_RUN);
+    metrics.eventsPerSecond = metrics.runWallTime > 0 ? events / metrics.runWallTime : 0.0;
+    metrics.peakMemory = PeakMemoryMegabytes();
+
+    // Write the summary and detail tables
+    timer.Enter(PHASE_OUTPUT);
+    if (config.writeArtifacts && reporting) {
+        std::vector<std::string> keyColumns, keys;
+        DescribeScenario(config, keyColumns, keys);
+        std::vector<std::string> valueColumns(kMetricNames, kMetricNames + kMetricCount);
+        valueColumns.push_back("simulationTime");
+        MetricsSample sample = FlattenMetrics(metrics);
+        std::vector<double> values(sample.values, sample.values + kMetricCount);
+        values.push_back(simulationTime);
+        MetricsTable summaryTable("summary", keyColumns, valueColumns);
+        summaryTable.AddRow(&keys[0], &values[0]);
+
+        std::vector<const MetricsTable *> tables;
+        tables.push_back(&summaryTable);
+        tables.push_back(&flowTable);
+        tables.push_back(&departmentTable);
+        tables.push_back(&matrixTable);
+        tables.push_back(&connectionTable);
+        tables.push_back(&clientTable);
+        tables.push_back(&uplinkTable);
+        tables.push_back(&linkTable);
+        tables.push_back(&failureTable);
+        tables.push_back(&convergenceTable);
+        tables.push_back(&workloadTable);
+        tables.push_back(&fctTable);
+        tables.push_back(&cacheTable);
+        WriteMetrics(config.metricsOutput, config.metricsFormat, tables);
+    }
+    timer.Stop();
+    if (!config.selfBenchmarkFile.empty()) {
+        AppendSelfBenchmark(config, topology, clients.size(), timer, events, metrics.peakMemory);
+    }
 
     Simulator::Destroy();
-    return 0;
+    delete anim;
+    return metrics;
+}
+
+
+// Parameter sweeps
+//
+// A sweep is a grid such as "dataRate=1Mbps,10Mbps;delay=2ms;clients=1,4;interval=1,0.5;seed=1-10".
+// Every configuration runs once per seed in its own forked process, so runs share no
+// simulator state, and the per-run metrics come back to the parent through a pipe.
+
+static ArrivalProcess ParseArrivalProcess(const std::string& name) {
+    if (name == "poisson") {
+        return ARRIVAL_POISSON;
+    } else if (name == "onoff") {
+        return ARRIVAL_ONOFF;
+    }
+    NS_ABORT_MSG_IF(name != "constant", "Unknown arrival process " << name);
+    return ARRIVAL_CONSTANT;
+}
+
+static PayloadDistribution ParsePayloadDistribution(const std::string& name) {
+    if (name == "uniform") {
+        return PAYLOAD_UNIFORM;
+    } else if (name == "exponential") {
+        return PAYLOAD_EXPONENTIAL;
+    } else if (name == "pareto") {
+        return PAYLOAD_PARETO;
+    }
+    NS_ABORT_MSG_IF(name != "fixed", "Unknown payload distribution " << name);
+    return PAYLOAD_FIXED;
+}
+
+static EcmpMode ParseEcmpMode(const std::string& name) {
+    if (name == "flow") {
+        return ECMP_FLOW;
+    } else if (name == "flowlet") {
+        return ECMP_FLOWLET;
+    }
+    NS_ABORT_MSG_IF(name != "off", "Unknown ECMP mode " << name);
+    return ECMP_OFF;
+}
+
+static CachePolicy ParseCachePolicy(const std::string& name) {
+    if (name == "lru") {
+        return CACHE_LRU;
+    } else if (name == "lfu") {
+        return CACHE_LFU;
+    } else if (name == "arc") {
+        return CACHE_ARC;
+    }
+    NS_ABORT_MSG_IF(name != "off", "Unknown cache policy " << name);
+    return CACHE_OFF;
+}
+
+// dataRate and delay override the topology together; fill in the campus default for a missing one
+static void CompleteLinkOverride(ScenarioConfig& config) {
+    if (config.dataRate.empty() != config.delay.empty()) {
+        if (config.dataRate.empty()) {
+            config.dataRate = "1Mbps";
+        } else {
+            config.delay = "2ms";
+        }
+    }
+}
+
+// Expands a sweep specification into configurations (seed left at base) and seeds
+static void ParseSweepGrid(const std::string& spec, const ScenarioConfig& base,
+                           std::vector<ScenarioConfig>& configs, std::vector<uint32_t>& seeds) {
+    configs.assign(1, base);
+    seeds.assign(1, base.seed);
+    std::vector<std::string> axes = SplitString(spec, ';');
+    for (size_t a = 0; a < axes.size(); ++a) {
+        std::string::size_type equals = axes[a].find('=');
+        NS_ABORT_MSG_IF(equals == std::string::npos, "Sweep axis '" << axes[a] << "' is not name=v1,v2,...");
+        std::string name = axes[a].substr(0, equals);
+        std::vector<std::string> values = SplitString(axes[a].substr(equals + 1), ',');
+        NS_ABORT_MSG_IF(values.empty(), "Sweep axis " << name << " has no values");
+
+        if (name == "seed") {
+            seeds = ParseIdList(axes[a].substr(equals + 1));
+            continue;
+        }
+
+        std::vector<ScenarioConfig> expanded;
+        expanded.reserve(configs.size() * values.size());
+        for (size_t c = 0; c < configs.size(); ++c) {
+            for (size_t v = 0; v < values.size(); ++v) {
+                ScenarioConfig config = configs[c];
+                if (name == "dataRate") {
+                    config.dataRate = values[v];
+                } else if (name == "delay") {
+                    config.delay = values[v];
+                } else if (name == "clients") {
+                    config.clientCount = ParseUnsigned(values[v], "Sweep clients");
+                } else if (name == "interval") {
+                    config.messageInterval = ParseNumber(values[v], "Sweep interval");
+                } else if (name == "rate") {
+                    config.load.rate = ParseNumber(values[v], "Sweep rate");
+                } else if (name == "ecmp") {
+                    config.ecmp = ParseEcmpMode(values[v]);
+                } else if (name == "scheduler") {
+                    SchedulerTypeName(values[v]);
+                    config.scheduler = values[v];
+                } else if (name == "tcp") {
+                    config.tcpVariant = ParseTcpVariant(values[v]);
+                } else if (name == "queueDisc") {
+                    QueueDiscTypeName(values[v]);
+                    config.queueDisc = values[v] == "default" ? "" : values[v];
+                } else if (name == "cache") {
+                    config.cache.policy = ParseCachePolicy(values[v]);
+                } else if (name == "cacheCapacity") {
+                    config.cache.capacity = ParseUnsigned(values[v], "Sweep cacheCapacity");
+                } else if (name == "zipf") {
+                    config.load.zipfExponent = ParseNumber(values[v], "Sweep zipf");
+                } else {
+                    NS_FATAL_ERROR("Unknown sweep axis " << name);
+                }
+                expanded.push_back(config);
+            }
+        }
+        configs.swap(expanded);
+    }
+    for (size_t c = 0; c < configs.size(); ++c) {
+        CompleteLinkOverride(configs[c]);
+    }
+}
+
+struct SweepJob {
+    uint32_t config;
+    uint32_t seed;
+    int readFd;
+    bool ok;
+    MetricsSample sample;
+    std::vector<double> departmentRetrieval;
+};
+
+static bool ReadFully(int fd, void *buffer, size_t size) {
+    char *bytes = static_cast<char *>(buffer);
+    while (size > 0) {
+        ssize_t n = read(fd, bytes, size);
+        if (n <= 0) {
+            return false;
+        }
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool WriteFully(int fd, const void *buffer, size_t size) {
+    const char *bytes = static_cast<const char *>(buffer);
+    while (size > 0) {
+        ssize_t n = write(fd, bytes, size);
+        if (n <= 0) {
+            return false;
+        }
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+// Mean and 95% confidence half-width of every metric of a configuration over its seeds
+struct SweepSummary {
+    size_t runs;
+    size_t failed;
+    double mean[kMetricCount];
+    double halfWidth[kMetricCount];
+};
+
+static std::vector<SweepSummary> SummarizeSweep(size_t configCount, const std::vector<SweepJob>& jobs) {
+    std::vector<SweepSummary> summaries(configCount);
+    for (size_t c = 0; c < configCount; ++c) {
+        RunningMoments moments[kMetricCount];
+        SweepSummary& summary = summaries[c];
+        summary.runs = 0;
+        summary.failed = 0;
+        for (size_t j = 0; j < jobs.size(); ++j) {
+            if (jobs[j].config != c) {
+                continue;
+            }
+            if (!jobs[j].ok) {
+                ++summary.failed;
+                continue;
+            }
+            ++summary.runs;
+            for (size_t m = 0; m < kMetricCount; ++m) {
+                moments[m].Add(jobs[j].sample.values[m]);
+            }
+        }
+
+        size_t runs = summary.runs;
+        for (size_t m = 0; m < kMetricCount; ++m) {
+            summary.mean[m] = moments[m].GetMean();
+            summary.halfWidth[m] = runs > 1 ? StudentT95(runs - 1) * std::sqrt(moments[m].GetVariance() / runs) : 0.0;
+        }
+    }
+    return summaries;
+}
+
+static void WriteSweepResults(std::string filename, const std::vector<ScenarioConfig>& configs,
+                              const std::vector<SweepSummary>& summaries) {
+    static const char *cachePolicies[] = { "off", "lru", "lfu", "arc" };
+    std::ofstream out(filename.c_str());
+    // One column per sweep axis other than seed
+    out << "config,dataRate,delay,clients,interval,rate,ecmp,scheduler,tcp,queueDisc,cache,cacheCapacity,zipf,"
+        << "runs,failed";
+    for (size_t m = 0; m < kMetricCount; ++m) {
+        out << "," << kMetricNames[m] << "_mean," << kMetricNames[m] << "_ci95";
+    }
+    out << "\n";
+
+    for (size_t c = 0; c < configs.size(); ++c) {
+        const ScenarioConfig& config = configs[c];
+        const SweepSummary& summary = summaries[c];
+        out << c << "," << config.dataRate << "," << config.delay << "," << config.clientCount << ","
+            << config.messageInterval << "," << config.load.rate << ","
+            << (config.ecmp == ECMP_FLOWLET ? "flowlet" : config.ecmp == ECMP_FLOW ? "flow" : "off") << ","
+            << config.scheduler << "," << config.tcpVariant << ","
+            << (config.queueDisc.empty() ? "default" : config.queueDisc) << ","
+            << cachePolicies[config.cache.policy] << "," << config.cache.capacity << ","
+            << config.load.zipfExponent << ","
+            << summary.runs << "," << summary.failed;
+        for (size_t m = 0; m < kMetricCount; ++m) {
+            out << "," << summary.mean[m] << "," << summary.halfWidth[m];
+        }
+        out << "\n";
+    }
+}
+
+// Mean retrieval time by department of a configuration's successful runs
+static std::vector<double> MeanDepartmentRetrieval(uint32_t config, const std::vector<SweepJob>& jobs, size_t& runs) {
+    std::vector<double> mean;
+    runs = 0;
+    for (size_t j = 0; j < jobs.size(); ++j) {
+        if (jobs[j].config != config || !jobs[j].ok) {
+            continue;
+        }
+        const std::vector<double>& retrieval = jobs[j].departmentRetrieval;
+        mean.resize(std::max(mean.size(), retrieval.size()), 0.0);
+        ++runs;
+        for (size_t d = 0; d < retrieval.size(); ++d) {
+            mean[d] += (retrieval[d] - mean[d]) / runs;
+        }
+    }
+    return mean;
+}
+
+// Edge cache gain measured against cache=off. Every configuration with a cache
+// policy is paired with the configuration that differs only in cache and
+// cacheCapacity and runs without caches; each department's mean retrieval time
+// is compared with the baseline's. Written next to the sweep results as
+// <results>_caches.csv, department by topology index; nothing is written when
+// the sweep has no cache axis.
+static void WriteCacheComparison(const std::string& filename, const std::vector<ScenarioConfig>& configs,
+                                 const std::vector<SweepJob>& jobs) {
+    std::vector<std::vector<std::string> > described(configs.size());
+    std::vector<std::string> names;
+    bool cached = false;
+    for (size_t c = 0; c < configs.size(); ++c) {
+        ScenarioConfig config = configs[c];
+        cached = cached || config.cache.policy != CACHE_OFF;
+        config.cache.policy = CACHE_OFF;
+        config.cache.capacity = 0;
+        DescribeScenario(config, names, described[c]);
+    }
+    if (!cached) {
+        return;
+    }
+
+    std::string base = filename;
+    if (base.size() > 4 && base.compare(base.size() - 4, 4, ".csv") == 0) {
+        base.resize(base.size() - 4);
+    }
+    std::ofstream out((base + "_caches.csv").c_str());
+    out << "config,baseline,department,runs,baselineRuns,retrievalTime,baselineRetrievalTime,reduction\n";
+    for (uint32_t c = 0; c < configs.size(); ++c) {
+        if (configs[c].cache.policy == CACHE_OFF) {
+            continue;
+        }
+        uint32_t baseline = 0;
+        while (baseline < configs.size()
+               && (configs[baseline].cache.policy != CACHE_OFF || described[baseline] != described[c])) {
+            ++baseline;
+        }
+        if (baseline == configs.size()) {
+            std::cerr << "Sweep configuration " << c << " has no cache=off baseline; add off to the cache axis\n";
+            continue;
+        }
+        size_t runs, baselineRuns;
+        std::vector<double> retrieval = MeanDepartmentRetrieval(c, jobs, runs);
+        std::vector<double> reference = MeanDepartmentRetrieval(baseline, jobs, baselineRuns);
+        for (size_t d = 0; d < std::min(retrieval.size(), reference.size()); ++d) {
+            // Departments without clients measured nothing
+            if (reference[d] == 0) {
+                continue;
+            }
+            out << c << "," << baseline << "," << d << "," << runs << "," << baselineRuns << ","
+                << retrieval[d] << "," << reference[d] << "," << 1.0 - retrieval[d] / reference[d] << "\n";
+        }
+    }
+}
+
+// Congestion control x queue disc comparison, printed and written as a metrics
+// table: one row per configuration with the mean over its seeds and the 95%
+// half-width. The config column matches the sweep results file.
+static void WriteBenchmarkReport(const std::vector<ScenarioConfig>& configs, const std::vector<SweepSummary>& summaries,
+                                 std::string base, MetricsFormat format) {
+    static const char *kReportMetrics[] = {
+        "avgThroughput", "requestLatencyP99", "lossRatio", "backboneQueueDelay", "linkQueueDrops"
+    };
+    static const size_t kReportCount = sizeof(kReportMetrics) / sizeof(kReportMetrics[0]);
+
+    std::vector<std::string> columns(1, "runs");
+    for (size_t r = 0; r < kReportCount; ++r) {
+        columns.push_back(kReportMetrics[r]);
+        columns.push_back(std::string(kReportMetrics[r]) + "_ci95");
+    }
+    MetricsTable report("benchmark", { "tcp", "queueDisc", "config" }, columns);
+
+    std::cout << std::left << std::setw(14) << "tcp" << std::setw(10) << "queueDisc" << std::right
+              << std::setw(14) << "thr KB/s" << std::setw(14) << "p99 req s" << std::setw(10) << "loss"
+              << std::setw(14) << "queue s/hop" << "\n";
+    for (size_t c = 0; c < configs.size(); ++c) {
+        const SweepSummary& summary = summaries[c];
+        std::vector<double> values(1, (double)summary.runs);
+        for (size_t r = 0; r < kReportCount; ++r) {
+            size_t m = MetricIndex(kReportMetrics[r]);
+            values.push_back(summary.mean[m]);
+            values.push_back(summary.halfWidth[m]);
+        }
+        std::string queueDisc = configs[c].queueDisc.empty() ? "default" : configs[c].queueDisc;
+        std::ostringstream config;
+        config << c;
+        std::string keys[] = { configs[c].tcpVariant, queueDisc, config.str() };
+        report.AddRow(keys, &values[0]);
+        std::cout << std::left << std::setw(14) << configs[c].tcpVariant << std::setw(10) << queueDisc << std::right
+                  << std::setw(14) << values[1] << std::setw(14) << values[3] << std::setw(10) << values[5]
+                  << std::setw(14) << values[7] << "\n";
+    }
+    WriteMetrics(base, format, std::vector<const MetricsTable *>(1, &report));
+}
+
+// Runs every configuration for every seed, at most `workers` processes at a time
+int RunSweep(const std::vector<ScenarioConfig>& configs, const std::vector<uint32_t>& seeds,
+             uint32_t workers, std::string filename, std::vector<SweepSummary> *results = 0) {
+    if (workers == 0) {
+        workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    std::vector<SweepJob> jobs;
+    jobs.reserve(configs.size() * seeds.size());
+    for (uint32_t c = 0; c < configs.size(); ++c) {
+        for (size_t s = 0; s < seeds.size(); ++s) {
+            SweepJob job = { c, seeds[s], -1, false, MetricsSample(), std::vector<double>() };
+            jobs.push_back(job);
+        }
+    }
+
+    std::map<pid_t, size_t> running;
+    size_t next = 0;
+    size_t failures = 0;
+    while (next < jobs.size() || !running.empty()) {
+        while (next < jobs.size() && running.size() < workers) {
+            SweepJob& job = jobs[next];
+            int fds[2];
+            NS_ABORT_MSG_IF(pipe(fds) != 0, "Cannot create sweep pipe");
+            pid_t pid = fork();
+            NS_ABORT_MSG_IF(pid < 0, "Cannot fork sweep worker");
+            if (pid == 0) {
+                // Workers fork without exec, so close-on-exec would not help: each keeps only its own pipe
+                close(fds[0]);
+                for (std::map<pid_t, size_t>::const_iterator it = running.begin(); it != running.end(); ++it) {
+                    close(jobs[it->second].readFd);
+                }
+                ScenarioConfig config = configs[job.config];
+                config.seed = job.seed;
+                NetworkMetrics metrics = RunScenario(config);
+                MetricsSample sample = FlattenMetrics(metrics);
+                uint32_t departments = metrics.departmentRetrieval.size();
+                bool written = WriteFully(fds[1], &sample, sizeof(sample))
+                               && WriteFully(fds[1], &departments, sizeof(departments))
+                               && WriteFully(fds[1], metrics.departmentRetrieval.data(), departments * sizeof(double));
+                _exit(written ? 0 : 1);
+            }
+            close(fds[1]);
+            job.readFd = fds[0];
+            running[pid] = next++;
+        }
+
+        int status = 0;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            break;
+        }
+        std::map<pid_t, size_t>::iterator it = running.find(pid);
+        if (it == running.end()) {
+            continue;
+        }
+        SweepJob& job = jobs[it->second];
+        uint32_t departments = 0;
+        job.ok = WIFEXITED(status) && WEXITSTATUS(status) == 0 && ReadFully(job.readFd, &job.sample, sizeof(job.sample))
+                 && ReadFully(job.readFd, &departments, sizeof(departments));
+        if (job.ok) {
+            job.departmentRetrieval.resize(departments);
+            job.ok = ReadFully(job.readFd, job.departmentRetrieval.data(), departments * sizeof(double));
+        }
+        close(job.readFd);
+        if (!job.ok) {
+            ++failures;
+            std::cerr << "Sweep run for configuration " << job.config << " seed " << job.seed << " failed\n";
+        }
+        running.erase(it);
+    }
+
+    std::vector<SweepSummary> summaries = SummarizeSweep(configs.size(), jobs);
+    WriteSweepResults(filename, configs, summaries);
+    WriteCacheComparison(filename, configs, jobs);
+    if (results) {
+        results->swap(summaries);
+    }
+    std::cout << "Sweep finished: " << jobs.size() << " runs over " << configs.size() << " configurations, "
+              << failures << " failed, " << workers << " workers -> " << filename << "\n";
+    return failures == 0 ? 0 : 1;
 }
 
+
+int main(int argc, char *argv[])
+{
+    ScenarioConfig config;
+    config.topologyFile = "";
+    config.departmentCount = 0;
+    config.hostsPerDepartment = 2;
+    config.coreCount = 2;
+    config.serverNode = 6;
+    config.clientNode = 22;
+    config.dataRate = "";
+    config.delay = "";
+    config.ecmp = ECMP_OFF;
+    config.flowletGap = 0.0005;
+    config.convergenceDelay = 0.05;
+    std::string failures = "";
+    config.tcpVariant = "NewReno";
+    config.queueDisc = "";
+    std::string tcpVariant = "NewReno";
+    std::string queueDisc = "default";
+    bool benchmark = false;
+    std::string benchmarkTcp = "NewReno,Cubic,Bbr,Dctcp";
+    std::string benchmarkQueues = "fifo,codel,fqcodel,red";
+    std::string ecmp = "off";
+    config.clientCount = 1;
+    config.messageInterval = 1.0;
+    config.stopTime = 10.0;
+    config.trafficMatrix = "";
+    config.precision = 0.0;
+    config.lossTolerance = 0.001;
+    config.batchInterval = 0.5;
+    config.minBatches = 10;
+    config.load = DefaultClientLoad();
+    config.service = DefaultServerService();
+    config.cache.policy = CACHE_OFF;
+    config.cache.capacity = 100;
+    std::string cache = "off";
+    std::string serviceModel = "fixed";
+    std::string arrival = "constant";
+    std::string payload = "fixed";
+    config.seed = 1;
+    config.writeArtifacts = true;
+    config.sampleInterval = 0.0;
+    config.timeSeriesFile = "timeseries.csv";
+    config.metricsFormat = METRICS_CSV;
+    config.metricsOutput = "network_metrics";
+    std::string metricsFormat = "csv";
+    config.traceFile = "";
+    config.traceCapacity = 1 << 20;
+    config.topLinks = 10;
+    config.scheduler = "map";
+    config.selfBenchmarkFile = "";
+    config.selfBenchmarkLabel = "";
+    std::string decodeTrace = "";
+    bool distributed = false;
+    config.animation = DefaultAnimation();
+    std::string sweep = "";
+    uint32_t sweepWorkers = 0;
+    std::string sweepOutput = "sweep_results.csv";
+
+    CommandLine cmd;
+    cmd.AddValue("topology", "Campus topology description file (built-in campus if empty)", config.topologyFile);
+    cmd.AddValue("departments", "Generate a campus with this many departments instead of loading one",
+                 config.departmentCount);
+    cmd.AddValue("hostsPerDepartment", "Leaf hosts per generated department", config.hostsPerDepartment);
+    cmd.AddValue("cores", "Multilayer core switches in a generated campus", config.coreCount);
+    cmd.AddValue("serverNode", "Node running the TCP server", config.serverNode);
+    cmd.AddValue("clientNode", "Node running the first TCP client", config.clientNode);
+    cmd.AddValue("dataRate", "Data rate of every link (topology rates if empty)", config.dataRate);
+    cmd.AddValue("delay", "Delay of every link, used with dataRate", config.delay);
+    cmd.AddValue("ecmp", "Equal-cost multipath over the cores: off, flow or flowlet", ecmp);
+    cmd.AddValue("flowletGap", "Idle seconds after which a flow may switch paths with ecmp=flowlet", config.flowletGap);
+    cmd.AddValue("failures", "Scheduled outages, e.g. node:7@4-6;link:30@5-7 (switch or link id, down-up seconds)",
+                 failures);
+    cmd.AddValue("convergence", "Seconds before routing reacts to a failure or recovery", config.convergenceDelay);
+    cmd.AddValue("tcp", "TCP congestion control: NewReno, Cubic, Bbr, Dctcp, Vegas, ...", tcpVariant);
+    cmd.AddValue("queueDisc", "Queue disc of backbone links: default, fifo, codel, fqcodel, red or pie", queueDisc);
+    cmd.AddValue("benchmark", "Run every tcp x queueDisc pair of benchmarkTcp and benchmarkQueues, "
+                 "combined with sweep axes", benchmark);
+    cmd.AddValue("benchmarkTcp", "TCP variants compared by the benchmark", benchmarkTcp);
+    cmd.AddValue("benchmarkQueues", "Backbone queue discs compared by the benchmark", benchmarkQueues);
+    cmd.AddValue("clients", "Number of TCP clients (0 = every leaf host)", config.clientCount);
+    cmd.AddValue("interval", "Seconds between client messages", config.messageInterval);
+    cmd.AddValue("trafficMatrix", "Department traffic matrix of bulk, rpc, voice and video flows "
+                 "(no workload if empty)", config.trafficMatrix);
+    cmd.AddValue("stopTime", "Longest run in simulated seconds", config.stopTime);
+    cmd.AddValue("precision", "Stop once throughput, mean/p99 delay and loss reach this relative "
+                 "95% CI half-width (0 = off)", config.precision);
+    cmd.AddValue("lossTolerance", "Absolute 95% CI half-width at which the loss ratio counts as converged",
+                 config.lossTolerance);
+    cmd.AddValue("batchInterval", "Seconds per batch of the convergence monitor", config.batchInterval);
+    cmd.AddValue("minBatches", "Batches needed after warm-up before stopping early", config.minBatches);
+    cmd.AddValue("arrival", "Request arrivals: constant, poisson or onoff", arrival);
+    cmd.AddValue("rate", "Requests per second per client (0 = 1/interval)", config.load.rate);
+    cmd.AddValue("burstOn", "Mean on period of onoff arrivals in seconds", config.load.burstOn);
+    cmd.AddValue("burstOff", "Mean off period of onoff arrivals in seconds", config.load.burstOff);
+    cmd.AddValue("payload", "Request size distribution: fixed, uniform, exponential or pareto", payload);
+    cmd.AddValue("payloadMin", "Smallest uniform request payload in bytes", config.load.payloadMin);
+    cmd.AddValue("payloadMax", "Largest request payload in bytes", config.load.payloadMax);
+    cmd.AddValue("paretoShape", "Shape of pareto request sizes", config.load.paretoShape);
+    cmd.AddValue("connections", "Parallel TCP connections per client", config.load.connections);
+    cmd.AddValue("pipeline", "Outstanding requests per connection (0 = unlimited)", config.load.maxOutstanding);
+    cmd.AddValue("backlog", "Requests a client queues while every connection is full", config.load.backlogLimit);
+    cmd.AddValue("serviceModel", "Server service times: fixed or exponential", serviceModel);
+    cmd.AddValue("serviceTime", "Mean server service time in seconds (0 = immediate)", config.service.meanServiceTime);
+    cmd.AddValue("workers", "Requests the server processes concurrently (0 = unlimited)", config.service.workers);
+    cmd.AddValue("queueLimit", "Requests waiting for a server worker before rejection (0 = unlimited)",
+                 config.service.queueLimit);
+    cmd.AddValue("maxConnections", "Connections the server accepts (0 = unlimited)", config.service.maxConnections);
+    cmd.AddValue("contents", "Named contents the clients request with Zipf popularity (0 = unnamed requests)",
+                 config.load.contentCount);
+    cmd.AddValue("zipf", "Zipf exponent of content popularity", config.load.zipfExponent);
+    cmd.AddValue("contentSize", "Response bytes of a named content", config.service.contentSize);
+    cmd.AddValue("cache", "Edge cache on every department switch: off, lru, lfu or arc", cache);
+    cmd.AddValue("cacheCapacity", "Contents (objects, not bytes) each edge cache holds", config.cache.capacity);
+    cmd.AddValue("seed", "Random number generator seed", config.seed);
+    cmd.AddValue("scheduler", "Event scheduler: map, heap, calendar, list or priority", config.scheduler);
+    cmd.AddValue("selfBenchmark", "Append per-phase wall time, events/s and peak memory of each run "
+                 "to this CSV (off if empty)", config.selfBenchmarkFile);
+    cmd.AddValue("selfBenchmarkLabel", "Label of the self-benchmark rows, e.g. the commit under test",
+                 config.selfBenchmarkLabel);
+    cmd.AddValue("sampleInterval", "Seconds between per-flow/per-link samples (0 = off)", config.sampleInterval);
+    cmd.AddValue("timeSeries", "Time-series output file", config.timeSeriesFile);
+    cmd.AddValue("topLinks", "Most utilized link directions in the links table (0 = all)", config.topLinks);
+    cmd.AddValue("metricsFormat", "Metrics output format: csv, json or binary", metricsFormat);
+    cmd.AddValue("metricsOutput", "Base name of the metrics output files", config.metricsOutput);
+    cmd.AddValue("trace", "Binary event trace output file (off if empty)", config.traceFile);
+    cmd.AddValue("traceCapacity", "Most recent events kept in the trace", config.traceCapacity);
+    cmd.AddValue("decodeTrace", "Print a binary event trace as text and exit", decodeTrace);
+    cmd.AddValue("animation", "NetAnim output file (off if empty)", config.animation.file);
+    cmd.AddValue("animStart", "Seconds at which packet animation starts", config.animation.start);
+    cmd.AddValue("animStop", "Seconds at which packet animation stops (0 = end of run)", config.animation.stop);
+    cmd.AddValue("animMaxPackets", "Packets per animation trace file; NetAnim continues in a new file past it",
+                 config.animation.maxPackets);
+    cmd.AddValue("distributed", "Run on the MPI distributed simulator, one department block per rank "
+                 "(not with --precision, --cache or --trafficMatrix)", distributed);
+    cmd.AddValue("sweep", "Parameter grid, e.g. "
+                 "dataRate=1Mbps,10Mbps;delay=2ms;clients=1,4;interval=1,0.5;rate=10,100;ecmp=off,flow;seed=1-10",
+                 sweep);
+    cmd.AddValue("jobs", "Concurrent sweep workers (0 = one per core)", sweepWorkers);
+    cmd.AddValue("sweepOutput", "Aggregated sweep results file", sweepOutput);
+    cmd.Parse(argc, argv);
+
+    if (!decodeTrace.empty()) {
+        return DecodeEventTrace(decodeTrace, std::cout);
+    }
+
+    CompleteLinkOverride(config);
+    config.load.arrival = ParseArrivalProcess(arrival);
+    config.ecmp = ParseEcmpMode(ecmp);
+    config.failures = ParseFailures(failures);
+    SchedulerTypeName(config.scheduler);
+    config.tcpVariant = ParseTcpVariant(tcpVariant);
+    QueueDiscTypeName(queueDisc);
+    config.queueDisc = queueDisc == "default" ? "" : queueDisc;
+    config.load.payload = ParsePayloadDistribution(payload);
+    config.cache.policy = ParseCachePolicy(cache);
+    NS_ABORT_MSG_IF(serviceModel != "fixed" && serviceModel != "exponential", "Unknown service model " << serviceModel);
+    config.service.model = serviceModel == "exponential" ? SERVICE_EXPONENTIAL : SERVICE_FIXED;
+    NS_ABORT_MSG_IF(metricsFormat != "csv" && metricsFormat != "json" && metricsFormat != "binary",
+                    "Unknown metrics format " << metricsFormat);
+    config.metricsFormat = metricsFormat == "json" ? METRICS_JSON
+                           : metricsFormat == "binary" ? METRICS_BINARY : METRICS_CSV;
+
+    NS_ABORT_MSG_IF(distributed && (!sweep.empty() || benchmark),
+                    "Sweeps fork their own workers and cannot run distributed");
+    if (distributed) {
+#ifdef NS3_MPI
+        GlobalValue::Bind("SimulatorImplementationType", StringValue("ns3::DistributedSimulatorImpl"));
+        MpiInterface::Enable(&argc, &argv);
+#else
+        NS_FATAL_ERROR("--distributed needs ns-3 configured with --enable-mpi");
+#endif
+    }
+
+    if (benchmark) {
+        std::vector<ScenarioConfig> configs;
+        std::vector<uint32_t> seeds;
+        std::vector<SweepSummary> summaries;
+        config.writeArtifacts = false;
+        ParseSweepGrid("tcp=" + benchmarkTcp + ";queueDisc=" + benchmarkQueues + (sweep.empty() ? "" : ";" + sweep),
+                       config, configs, seeds);
+        int status = RunSweep(configs, seeds, sweepWorkers, sweepOutput, &summaries);
+        WriteBenchmarkReport(configs, summaries, config.metricsOutput, config.metricsFormat);
+        return status;
+    }
+
+    if (!sweep.empty()) {
+        std::vector<ScenarioConfig> configs;
+        std::vector<uint32_t> seeds;
+        config.writeArtifacts = false;
+        ParseSweepGrid(sweep, config, configs, seeds);
+        return RunSweep(configs, seeds, sweepWorkers, sweepOutput);
+    }
+
+    LogComponentEnable("top", LOG_LEVEL_INFO);
+
+    RunScenario(config);
+#ifdef NS3_MPI
+    if (distributed) {
+        MpiInterface::Disable();
+    }
+#endif
+    return 0;
+}